@@ -27,43 +27,108 @@
 #define CV_DRAWWATERSHED_INCLUDED
 
 #include <stdio.h>
+#include <string.h>
+#include <limits.h>
 #include <string>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CV_WATERSHED_SSE2 1
+#endif
 
 // marker's shape is like circle
 // just for imageclipper.cpp for now
-CvRect cvDrawWatershed( IplImage* img, const CvRect circle )
+//
+// Markers are set, flooded, and scanned only in the bounding box of the
+// 3 * radius disc padded by CV_WATERSHED_PAD pixels. The padding keeps
+// a ring of the outer marker (1) inside of the border which cvWatershed 
+// sets to -1, so the result is the same as running on the whole image.
+#define CV_WATERSHED_PAD 2
+
+// Run watershed for a circle marker. 
+// Returns the markers of roi (release it), or NULL if roi is empty.
+IplImage* cvWatershedCircle( const IplImage* img, const CvRect circle, CvRect* roi )
 {
-    IplImage* markers  = cvCreateImage( cvGetSize( img ), IPL_DEPTH_32S, 1 );
     CvPoint center = cvPoint( circle.x, circle.y );
     int radius = circle.width;
+    int r = 3 * abs( radius ) + CV_WATERSHED_PAD;
+    int x1 = max( 0, center.x - r ), y1 = max( 0, center.y - r );
+    int x2 = min( img->width, center.x + r + 1 ), y2 = min( img->height, center.y + r + 1 );
+    *roi = cvRect( 0, 0, 0, 0 );
+    if( x1 >= x2 || y1 >= y2 ) return NULL;
+    *roi = cvRect( x1, y1, x2 - x1, y2 - y1 );
+    CvPoint roicenter = cvPoint( center.x - roi->x, center.y - roi->y );
+
+    CvMat subimg;
+    cvGetSubRect( img, &subimg, *roi );
+    IplImage* markers  = cvCreateImage( cvSize( roi->width, roi->height ), IPL_DEPTH_32S, 1 );
 
     // Set watershed markers. Now, marker's shape is like circle
     // Set (1 * radius) - (3 * radius) region as ambiguous region (0), intuitively
     cvSet( markers, cvScalarAll( 1 ) );
-    cvCircle( markers, center, 3 * radius, cvScalarAll( 0 ), CV_FILLED, 8, 0 );
-    cvCircle( markers, center, radius, cvScalarAll( 2 ), CV_FILLED, 8, 0 );
-    cvWatershed( img, markers );
+    cvCircle( markers, roicenter, 3 * radius, cvScalarAll( 0 ), CV_FILLED, 8, 0 );
+    cvCircle( markers, roicenter, radius, cvScalarAll( 2 ), CV_FILLED, 8, 0 );
+    cvWatershed( &subimg, markers );
+    return markers;
+}
 
+// Draw the circle marker and watershed boundaries of cvWatershedCircle.
+// Returns the rectangle surrounding the boundaries.
+// img may be a view of the image whose (0,0) is at origin and which is
+// shrunk by 2^shift, e.g., a pyramid level. Pixels outside of img are not drawn.
+CvRect cvDrawWatershedCircle( IplImage* img, const CvRect circle, const IplImage* markers, CvRect roi,
+                              CvPoint origin = cvPoint( 0, 0 ), int shift = 0 )
+{
     // Draw watershed markers and rectangle surrounding watershed markers
-    cvCircle( img, center, radius, cvScalarAll (255), 2, 8, 0);
+    cvCircle( img, cvPoint( ( circle.x - origin.x ) >> shift, ( circle.y - origin.y ) >> shift ), 
+              circle.width >> shift, cvScalarAll (255), 2, 8, 0);
+    if( markers == NULL ) return cvRect( 0, 0, 0, 0 );
 
-    CvPoint minpoint = cvPoint( markers->width, markers->height );
+    CvPoint minpoint = cvPoint( INT_MAX, INT_MAX );
     CvPoint maxpoint = cvPoint( 0, 0 );
+    int cn = img->nChannels; // 8UC3 as cvWatershed requires
+#if defined(CV_WATERSHED_SSE2)
+    const __m128i minus1 = _mm_set1_epi32( -1 );
+#endif
     for (int y = 1; y < markers->height-1; y++) { // looks outer boundary is always -1. 
-        for (int x = 1; x < markers->width-1; x++) {
-            int* idx = (int *) cvPtr2D (markers, y, x, NULL);
-            if (*idx == -1) { // watershed marker -1
-                cvSet2D (img, y, x, cvScalarAll (255));
-                if( x < minpoint.x ) minpoint.x = x;
-                if( y < minpoint.y ) minpoint.y = y;
-                if( x > maxpoint.x ) maxpoint.x = x;
-                if( y > maxpoint.y ) maxpoint.y = y;
+        const int* labels = (const int*)( markers->imageData + markers->widthStep * y );
+        int ry = ( y + roi.y - origin.y ) >> shift;
+        uchar* row = ( ry >= 0 && ry < img->height ) ? (uchar*)img->imageData + img->widthStep * ry : NULL;
+        int x = 1, end = markers->width - 1, first = -1, last = -1;
+        while( x < end ) {
+#if defined(CV_WATERSHED_SSE2)
+            // skip 4 labels at once while none of them is a boundary
+            while( x <= end - 4 && 
+                   !_mm_movemask_epi8( _mm_cmpeq_epi32( _mm_loadu_si128( (const __m128i*)( labels + x ) ), minus1 ) ) )
+                x += 4;
+            if( x >= end ) break;
+#endif
+            if (labels[x] == -1) { // watershed marker -1
+                int rx = ( x + roi.x - origin.x ) >> shift;
+                if( row != NULL && rx >= 0 && rx < img->width ) memset( row + rx * cn, 255, cn );
+                if( first < 0 ) first = x;
+                last = x;
             }
+            x++;
         }
+        if( first < 0 ) continue; // no boundary in this row
+        if( first + roi.x < minpoint.x ) minpoint.x = first + roi.x;
+        if( last + roi.x > maxpoint.x ) maxpoint.x = last + roi.x;
+        if( y + roi.y < minpoint.y ) minpoint.y = y + roi.y;
+        maxpoint.y = y + roi.y;
     }
+    if( maxpoint.x < minpoint.x ) return cvRect( 0, 0, 0, 0 ); // no boundary
     return cvRect( minpoint.x, minpoint.y, maxpoint.x - minpoint.x, maxpoint.y - minpoint.y );
 }
 
+CvRect cvDrawWatershed( IplImage* img, const CvRect circle )
+{
+    CvRect roi;
+    IplImage* markers = cvWatershedCircle( img, circle, &roi );
+    CvRect rect = cvDrawWatershedCircle( img, circle, markers, roi );
+    if( markers != NULL ) cvReleaseImage( &markers );
+    return rect;
+}
+
 inline CvRect cvShowImageAndWatershed( const char* w_name, const IplImage* img, const CvRect &circle )
 {
     IplImage* clone = cvCloneImage( img );
@@ -31,15 +31,28 @@
 #define FILESYSTEM_INCLUDED
 
 #include <boost/filesystem.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
 #include <vector>
+#include <ctime>
+#include <ctype.h>
+#include <stdlib.h>
 using namespace std;
 
 namespace filesystem {
 
-    inline void r_mkdir( const string& path )
+    inline bool r_mkdir( const string& path )
     {
-        boost::filesystem::path fspath( path );
-        boost::filesystem::create_directories( fspath );
+        try
+        {
+            boost::filesystem::path fspath( path );
+            boost::filesystem::create_directories( fspath );
+        }
+        catch( const boost::filesystem::filesystem_error& )
+        {
+            return false;
+        }
+        return true;
     }
 
     inline bool is_dir( const string& path )
@@ -54,12 +67,44 @@ namespace filesystem {
         return boost::filesystem::exists( fspath );
     }
 
+    inline size_t filesize( const string& path )
+    {
+        boost::filesystem::path fspath( path );
+        return (size_t)boost::filesystem::file_size( fspath );
+    }
+
+    inline time_t mtime( const string& path )
+    {
+        boost::filesystem::path fspath( path );
+        return boost::filesystem::last_write_time( fspath );
+    }
+
     inline string realpath( const string& path )
     {
         boost::filesystem::path fspath( path );
         return fspath.native_file_string();
     }
 
+    /**
+    * The absolute path without ., .. and symbolic links, which is the same
+    * however the path is spelled and from whichever directory
+    *
+    * @return path as is if it does not exist
+    */
+    inline string canonical( const string& path )
+    {
+#if defined(WIN32) || defined(WIN64)
+        char resolved[_MAX_PATH];
+        return _fullpath( resolved, path.c_str(), _MAX_PATH ) != NULL ? string( resolved ) : path;
+#else
+        char* resolved = ::realpath( path.c_str(), NULL );
+        if( resolved == NULL ) return path;
+        string ret( resolved );
+        free( resolved );
+        return ret;
+#endif
+    }
+
     inline string dirname( const string& path )
     {
         boost::filesystem::path fspath( path );
@@ -85,6 +130,40 @@ namespace filesystem {
         return string( boost::filesystem::extension( fspath ), 1 );
     }
 
+    /**
+    * A path decomposed once into the parts of an output path format
+    *
+    * The entries of a directory share one dirname string.
+    */
+    typedef struct file_entry {
+        string path;                            /**< native path */
+        boost::shared_ptr<const string> dirname;
+        string stem;                            /**< filename without extension */
+        string extension;                       /**< filename extension without dot */
+    } file_entry;
+
+    /**
+    * @param path     The native path
+    * @param leaf     The filename of path
+    * @param dir      The dirname of path shared with other entries
+    */
+    inline file_entry decompose( const string& path, const string& leaf, const boost::shared_ptr<const string>& dir )
+    {
+        file_entry entry;
+        entry.path = path;
+        entry.dirname = dir;
+        string::size_type dot = leaf.rfind( '.' );
+        entry.stem = leaf.substr( 0, dot );
+        entry.extension = dot == string::npos ? string() : leaf.substr( dot + 1 );
+        return entry;
+    }
+
+    inline file_entry decompose( const string& path )
+    {
+        boost::shared_ptr<const string> dir( new string( dirname( path ) ) );
+        return decompose( realpath( path ), basename( path ), dir );
+    }
+
     inline string strtolower( const string& str )
     {
         string ret = str;
@@ -95,14 +174,139 @@ namespace filesystem {
         return ret;
     }
 
-    bool match_extensions( const string& filename, const vector<string>& extensions )
+    inline int natural_rank( char c )
+    {
+        return ( c == '/' || c == '\\' ) ? -1 : (unsigned char)c;
+    }
+
+    /**
+    * Natural order of paths, e.g., frame_2 < frame_10
+    *
+    * Runs of digits are compared as numbers, and path separators come
+    * before any other character so that files of a directory stay together.
+    * Names equal as numbers, e.g., 01 and 1, are ordered by characters.
+    */
+    inline bool natural_less( const string& a, const string& b )
     {
-        string extension = boost::filesystem::extension( filename );
-        extension = strtolower( extension );
-        for( size_t i = 0; i < extensions.size() - 1; i++ ) {
-            if( extension == "." + extensions[i] ) return true;
+        size_t i = 0, j = 0;
+        while( i < a.size() && j < b.size() )
+        {
+            if( isdigit( (unsigned char)a[i] ) && isdigit( (unsigned char)b[j] ) )
+            {
+                size_t zi = i, zj = j;
+                while( zi < a.size() && a[zi] == '0' ) zi++;
+                while( zj < b.size() && b[zj] == '0' ) zj++;
+                size_t ei = zi, ej = zj;
+                while( ei < a.size() && isdigit( (unsigned char)a[ei] ) ) ei++;
+                while( ej < b.size() && isdigit( (unsigned char)b[ej] ) ) ej++;
+                if( ei - zi != ej - zj ) return ei - zi < ej - zj;
+                int cmp = a.compare( zi, ei - zi, b, zj, ej - zj );
+                if( cmp != 0 ) return cmp < 0;
+                i = ei;
+                j = ej;
+                continue;
+            }
+            if( a[i] != b[j] ) return natural_rank( a[i] ) < natural_rank( b[j] );
+            i++;
+            j++;
+        }
+        if( ( i == a.size() ) != ( j == b.size() ) ) return i == a.size();
+        return a < b;
+    }
+
+    /**
+    * A set of filename extensions compiled for case insensitive matching
+    *
+    * Extensions of up to 8 characters are packed into 64-bit keys of an
+    * open addressing hash table, so a match neither allocates nor
+    * compares strings. A compiled set is read only and can be shared
+    * between threads.
+    */
+    class extension_set {
+    public:
+        extension_set() : mask( 0 ) {}
+
+        /** @param extensions  Extensions without the leading dot */
+        explicit extension_set( const vector<string>& extensions ) : mask( 0 )
+        {
+            size_t size = 16;
+            while( size < extensions.size() * 2 ) size *= 2;
+            table.assign( size, 0 );
+            mask = size - 1;
+            for( size_t i = 0; i < extensions.size(); i++ )
+            {
+                const string& ext = extensions[i];
+                if( ext.empty() ) continue;
+                if( ext.size() > 8 )
+                {
+                    longer.push_back( strtolower( ext ) );
+                    continue;
+                }
+                boost::uint64_t key = pack( ext.data(), ext.size() );
+                size_t j = slot( key );
+                while( table[j] != 0 && table[j] != key ) j = ( j + 1 ) & mask;
+                table[j] = key;
+            }
         }
-        return false;
+
+        /** @return true if the extension of the filename is in the set */
+        bool match( const string& filename ) const
+        {
+            size_t dot = filename.find_last_of( "./\\" );
+            if( dot == string::npos || filename[dot] != '.' || dot + 1 == filename.size() ) return false;
+            const char* ext = filename.data() + dot + 1;
+            size_t len = filename.size() - dot - 1;
+            if( len > 8 )
+            {
+                for( size_t i = 0; i < longer.size(); i++ )
+                {
+                    if( longer[i].size() == len && equal_lower( ext, longer[i].data(), len ) ) return true;
+                }
+                return false;
+            }
+            if( table.empty() ) return false;
+            boost::uint64_t key = pack( ext, len );
+            for( size_t j = slot( key ); table[j] != 0; j = ( j + 1 ) & mask )
+            {
+                if( table[j] == key ) return true;
+            }
+            return false;
+        }
+
+    private:
+        static boost::uint64_t pack( const char* ext, size_t len )
+        {
+            boost::uint64_t key = 0;
+            for( size_t i = 0; i < len; i++ )
+            {
+                key |= (boost::uint64_t)(unsigned char)tolower( (unsigned char)ext[i] ) << ( 8 * i );
+            }
+            return key;
+        }
+
+        size_t slot( boost::uint64_t key ) const
+        {
+            // Fibonacci hashing
+            return (size_t)( ( key * 0x9E3779B97F4A7C15ULL ) >> 32 ) & mask;
+        }
+
+        static bool equal_lower( const char* ext, const char* lower, size_t len )
+        {
+            for( size_t i = 0; i < len; i++ )
+            {
+                if( tolower( (unsigned char)ext[i] ) != (unsigned char)lower[i] ) return false;
+            }
+            return true;
+        }
+
+        vector<boost::uint64_t> table; /**< packed lower case extensions, 0 for empty */
+        size_t mask;
+        vector<string> longer;         /**< lower case extensions longer than 8 */
+    };
+
+    inline bool match_extensions( const string& filename, const extension_set& extensions )
+    {
+        return extensions.match( filename );
     }
 
     vector<string> filelist( const string& dirpath, 
@@ -123,10 +327,11 @@ namespace filesystem {
             return filelist;
         }
         
+        extension_set imset( extensions );
         boost::filesystem::directory_iterator iter( fs_dirpath ), end_iter;
         for( ; iter != end_iter; ++iter ) {
             boost::filesystem::path filename = iter->path();
-            if( match_extensions( filename.native_file_string(), extensions ) ) {
+            if( imset.match( filename.native_file_string() ) ) {
                 if(list_all) {
                     filelist.push_back( filename.native_file_string() );
                 } else if(list_regular_file && boost::filesystem::is_regular( filename )) {
@@ -0,0 +1,272 @@
+/** @file
+*
+* Image clipper batch (non-GUI) clipping
+*
+* The MIT License
+*
+* Copyright (c) 2008, Naotoshi Seo <sonots(at)umd.edu>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#ifndef IC_BATCH_INCLUDED
+#define IC_BATCH_INCLUDED
+
+#include "cv.h"
+#include "cxcore.h"
+#include "highgui.h"
+#include <stdio.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include "filesystem.h"
+#include "icformat.h"
+#include "icthreadpool.h"
+#include "ichaartraining.h"
+#include "icjournal.h"
+#include "icsave.h"
+#include "opencvx/cvrect32f.h"
+#include "opencvx/cvcropimageroi.h"
+
+/**
+* A region to be clipped in batch mode
+*/
+typedef struct IcBatchRegion {
+    string filename;           /**< source image */
+    CvRect rect;               /**< rectangle region */
+    int rotate;                /**< rotation angle */
+    CvPoint shear;             /**< shear deformation */
+} IcBatchRegion;
+
+/**
+* Read a region manifest
+*
+* Each line is
+* <pre>
+* filename x y width height [rotation [shear_x shear_y]]
+* </pre>
+* Empty lines and lines starting with # are ignored.
+* Filenames must not contain white spaces.
+*
+* @param path     The manifest filename
+* @param regions  The regions read (appended)
+* @return false if the manifest could not be opened
+*/
+bool icReadBatchManifest( const string& path, vector<IcBatchRegion>& regions )
+{
+    ifstream ifs( path.c_str() );
+    if( !ifs ) return false;
+
+    string line;
+    for( int lineno = 1; getline( ifs, line ); lineno++ )
+    {
+        if( !line.empty() && line[line.size() - 1] == '\r' ) line.erase( line.size() - 1 );
+        string::size_type head = line.find_first_not_of( " \t" );
+        if( head == string::npos || line[head] == '#' ) continue;
+
+        IcBatchRegion region;
+        region.rotate = 0;
+        region.shear  = cvPoint( 0, 0 );
+        istringstream iss( line );
+        if( !( iss >> region.filename
+                   >> region.rect.x >> region.rect.y
+                   >> region.rect.width >> region.rect.height ) )
+        {
+            cerr << path << ":" << lineno << ": Invalid line is skipped." << endl;
+            continue;
+        }
+        if( iss >> region.rotate )
+        {
+            iss >> region.shear.x >> region.shear.y;
+        }
+        regions.push_back( region );
+    }
+    return true;
+}
+
+/**
+* Shared state of a batch run
+*/
+typedef struct IcBatchContext {
+    IcFormat output_format;             /**< compiled output file path format */
+    filesystem::extension_set imtypes;  /**< supported image types */
+    set<string> made_dirs;              /**< output directories created */
+    int nfailed;                        /**< number of regions failed */
+    IcHaarTrainingWriter* positives;    /**< regions saved, or NULL */
+    IcJournal* journal;                 /**< journal of regions saved, or NULL */
+    IcImageSink* sink;                  /**< written to instead of files, or NULL */
+    boost::mutex mutex;                 /**< guards made_dirs, nfailed and stdout */
+} IcBatchContext;
+
+/**
+* Clip all regions of one source image. The image is decoded once.
+*
+* @param group    The regions sharing the same source image
+* @param context  The batch context
+* @return void
+*/
+void icClipBatchImage( const vector<const IcBatchRegion*>* group, IcBatchContext* context )
+{
+    const string& filename = group->front()->filename;
+    filesystem::file_entry entry = filesystem::decompose( filename ); // once for all regions
+    IplImage* img = cvLoadImage( entry.path.c_str() );
+    if( img == NULL )
+    {
+        boost::mutex::scoped_lock lock( context->mutex );
+        cerr << "The image file " << filename << " is not loadable." << endl;
+        context->nfailed += (int)group->size();
+        return;
+    }
+
+    for( size_t i = 0; i < group->size(); i++ )
+    {
+        const IcBatchRegion& region = *(*group)[i];
+        if( region.rect.width <= 0 || region.rect.height <= 0 )
+        {
+            boost::mutex::scoped_lock lock( context->mutex );
+            cerr << "The region of " << filename << " is empty." << endl;
+            context->nfailed++;
+            continue;
+        }
+
+        string output_path = context->output_format(
+            *entry.dirname, entry.stem, entry.extension,
+            region.rect.x, region.rect.y, region.rect.width, region.rect.height,
+            0, region.rotate, region.shear.x, region.shear.y );
+        if( !context->imtypes.match( output_path ) )
+        {
+            boost::mutex::scoped_lock lock( context->mutex );
+            cerr << "The image type " << filesystem::extension( output_path ) << " is not supported." << endl;
+            context->nfailed++;
+            continue;
+        }
+        output_path = filesystem::realpath( output_path );
+        if( context->sink == NULL )
+        {
+            boost::mutex::scoped_lock lock( context->mutex );
+            string output_dir = filesystem::dirname( output_path );
+            if( context->made_dirs.insert( output_dir ).second )
+            {
+                filesystem::r_mkdir( output_dir );
+            }
+        }
+
+        IplImage* crop = cvCreateImage(
+            cvSize( region.rect.width, region.rect.height ),
+            img->depth, img->nChannels );
+        cvCropImageROI( img, crop,
+                        cvRect32fFromRect( region.rect, region.rotate ),
+                        cvPointTo32f( region.shear ) );
+        bool saved = context->sink != NULL ? context->sink->write( output_path, crop ) :
+            cvSaveImage( output_path.c_str(), crop ) != 0;
+        cvReleaseImage( &crop );
+        if( saved && context->positives != NULL )
+        {
+            context->positives->add( filename, region.rect, region.rotate, region.shear );
+        }
+        if( saved && context->journal != NULL )
+        {
+            context->journal->append( entry.path, output_path, 0, region.rect, region.rotate, region.shear );
+        }
+
+        boost::mutex::scoped_lock lock( context->mutex );
+        if( saved )
+        {
+            cout << output_path << endl;
+        }
+        else
+        {
+            cerr << "Failed to write " << output_path << endl;
+            context->nfailed++;
+        }
+    }
+    cvReleaseImage( &img );
+}
+
+/**
+* Clip regions without GUI
+*
+* Regions are grouped by their source image so that each image is
+* decoded exactly once, and the groups are distributed over a
+* work-stealing thread pool.
+*
+* @param regions        The regions to be clipped
+* @param output_format  The output file path format (see icFormat)
+* @param imtypes        The supported image types
+* @param [nthreads = 1] The number of worker threads. 0 for the number of cores.
+* @param [positives = NULL]
+*                       Regions saved are added to this if given
+* @param [journal = NULL]
+*                       Regions saved are appended to this if given
+* @param [sink = NULL]  Images are written to this instead of files if given
+* @return the number of regions failed
+*/
+int icClipBatch( const vector<IcBatchRegion>& regions, const string& output_format,
+                 const vector<string>& imtypes, int nthreads = 1,
+                 IcHaarTrainingWriter* positives = NULL, IcJournal* journal = NULL,
+                 IcImageSink* sink = NULL )
+{
+    IcBatchContext context;
+    context.output_format = IcFormat( output_format );
+    context.imtypes = filesystem::extension_set( imtypes );
+    context.nfailed = 0;
+    context.positives = positives;
+    context.journal = journal;
+    context.sink = sink;
+
+    // group by source image keeping the manifest order
+    map<string, size_t> group_index;
+    vector< vector<const IcBatchRegion*> > groups;
+    for( size_t i = 0; i < regions.size(); i++ )
+    {
+        map<string, size_t>::iterator it = group_index.find( regions[i].filename );
+        if( it == group_index.end() )
+        {
+            it = group_index.insert( make_pair( regions[i].filename, groups.size() ) ).first;
+            groups.push_back( vector<const IcBatchRegion*>() );
+        }
+        groups[it->second].push_back( &regions[i] );
+    }
+
+    if( nthreads == 1 )
+    {
+        for( size_t i = 0; i < groups.size(); i++ )
+        {
+            icClipBatchImage( &groups[i], &context );
+        }
+    }
+    else
+    {
+        IcThreadPool pool( nthreads );
+        for( size_t i = 0; i < groups.size(); i++ )
+        {
+            pool.push( boost::bind( icClipBatchImage, &groups[i], &context ) );
+        }
+        pool.wait();
+    }
+    return context.nfailed;
+}
+
+#endif
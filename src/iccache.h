@@ -0,0 +1,176 @@
+/** @file
+*
+* Image clipper decoded image cache
+*
+* The MIT License
+*
+* Copyright (c) 2008, Naotoshi Seo <sonots(at)umd.edu>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#ifndef IC_CACHE_INCLUDED
+#define IC_CACHE_INCLUDED
+
+#include "cv.h"
+#include "cxcore.h"
+#include <iostream>
+#include <string>
+#include <list>
+#include <map>
+#include <boost/thread.hpp>
+using namespace std;
+
+/**
+* A thread safe LRU cache of decoded images with a memory budget
+*
+* Keys are file paths, or anything identifying a decoded image such as
+* a video frame. The cache owns inserted images. The pinned image, the
+* one shown now, is never evicted so that the caller may keep using it
+* until another image is pinned.
+*/
+class IcImageCache {
+public:
+    /**
+    * @param budget  The memory budget in bytes
+    */
+    explicit IcImageCache( size_t budget )
+        : budget( budget ), bytes( 0 ), hits( 0 ), misses( 0 )
+    {
+    }
+
+    ~IcImageCache()
+    {
+        for( list<Entry>::iterator it = entries.begin(); it != entries.end(); ++it )
+        {
+            if( it->img != NULL ) cvReleaseImage( &it->img );
+        }
+    }
+
+    /**
+    * Look up an image and pin it. Counts a hit or a miss.
+    *
+    * @param key  The key
+    * @param img  The image found. NULL is a valid cached value for a
+    *             file which could not be decoded.
+    * @return true if found
+    */
+    bool acquire( const string& key, IplImage*& img )
+    {
+        boost::mutex::scoped_lock lock( mutex );
+        map<string, list<Entry>::iterator>::iterator it = index.find( key );
+        if( it == index.end() )
+        {
+            misses++;
+            return false;
+        }
+        hits++;
+        entries.splice( entries.begin(), entries, it->second );
+        img = it->second->img;
+        pinned = key;
+        trim();
+        return true;
+    }
+
+    /**
+    * Insert an image. The cache takes the ownership.
+    *
+    * If the key exists, the given image is released and the cached one is
+    * returned instead.
+    *
+    * @param key         The key
+    * @param img         The image (may be NULL)
+    * @param [pin=false] Pin the image
+    * @return The cached image
+    */
+    IplImage* insert( const string& key, IplImage* img, bool pin = false )
+    {
+        boost::mutex::scoped_lock lock( mutex );
+        map<string, list<Entry>::iterator>::iterator it = index.find( key );
+        if( it != index.end() )
+        {
+            if( img != NULL && img != it->second->img ) cvReleaseImage( &img );
+            entries.splice( entries.begin(), entries, it->second );
+            img = it->second->img;
+        }
+        else
+        {
+            Entry entry = { key, img };
+            entries.push_front( entry );
+            index[key] = entries.begin();
+            bytes += size_of( img );
+        }
+        if( pin ) pinned = key;
+        trim();
+        return img;
+    }
+
+    /**
+    * @return true if the key is cached. Does not count hits or misses.
+    */
+    bool contains( const string& key )
+    {
+        boost::mutex::scoped_lock lock( mutex );
+        return index.find( key ) != index.end();
+    }
+
+    void print_stats( ostream& os )
+    {
+        boost::mutex::scoped_lock lock( mutex );
+        os << "Image cache: " << hits << " hits, " << misses << " misses, "
+           << entries.size() << " images (" << bytes / ( 1024 * 1024 ) << " MB) cached." << endl;
+    }
+
+    static size_t size_of( const IplImage* img )
+    {
+        return img != NULL ? (size_t)img->imageSize : 0;
+    }
+
+private:
+    struct Entry {
+        string key;
+        IplImage* img;
+    };
+
+    /** Evict least recently used images until the budget is met */
+    void trim()
+    {
+        list<Entry>::iterator it = entries.end();
+        while( bytes > budget && it != entries.begin() )
+        {
+            --it;
+            if( it->key == pinned ) continue;
+            bytes -= size_of( it->img );
+            if( it->img != NULL ) cvReleaseImage( &it->img );
+            index.erase( it->key );
+            it = entries.erase( it );
+        }
+    }
+
+    size_t budget;
+    size_t bytes;
+    int hits;
+    int misses;
+    string pinned;
+    list<Entry> entries;                          /**< most recently used first */
+    map<string, list<Entry>::iterator> index;
+    boost::mutex mutex;
+};
+
+#endif
@@ -0,0 +1,480 @@
+/** @file
+*
+* Image clipper main window display buffer
+*
+* The MIT License
+*
+* Copyright (c) 2008, Naotoshi Seo <sonots(at)umd.edu>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#ifndef IC_DISPLAY_INCLUDED
+#define IC_DISPLAY_INCLUDED
+
+#include "cv.h"
+#include "cxcore.h"
+#include "highgui.h"
+#include <math.h>
+#include <iostream>
+#include <vector>
+#include "cvdrawwatershed.h"
+#include "ictiled.h"
+#include "opencvx/cvrect32f.h"
+#include "opencvx/cvdrawrectangle.h"
+#include "opencvx/cvcropimageroi.h"
+using namespace std;
+
+/**
+* A persistent display buffer of the main window
+*
+* The window shows a viewport of at most view_size pixels cut out of a
+* level of an image pyramid. Level 0 is the image itself and each level
+* is the cvPyrDown of the previous one, built when it is first shown.
+* An image is initially shown at the finest level which fits in the
+* viewport, and may be zoomed and panned.
+*
+* The viewport is copied into the buffer once when the image or the view
+* changes. Drawing records the regions it touches, and the next drawing
+* copies only those regions back from the level instead of cloning the
+* whole image, so a redraw costs in proportion to the perimeter of the
+* rectangle (or the size of the watershed marker), not to the size of
+* the image.
+*
+* Coordinates given to and returned from show_*() are in the image.
+* Window coordinates are converted with to_image().
+*
+* The image may be an IcTiledImage instead of an IplImage. Then levels
+* are sampled from it region by region, and watershed and cropping read
+* only the region under the marker or the rectangle.
+*/
+class IcDisplay {
+public:
+    /**
+    * @param w_name  The window name
+    * @param [view_size = cvSize(0,0)]
+    *                The maximum size of the viewport. 0 for no limit.
+    */
+    explicit IcDisplay( const char* w_name, CvSize view_size = cvSize( 0, 0 ) )
+        : w_name( w_name ), view_size( view_size ), src( NULL ), tiled( NULL ), buf( NULL ), level( 0 ),
+          offset( cvPoint( 0, 0 ) ), markers( NULL ), has_markers( false ),
+          watershed_ticks( 0 ), nwatershed( 0 ), nreused( 0 )
+    {
+    }
+
+    ~IcDisplay()
+    {
+        release_levels();
+        if( buf != NULL ) cvReleaseImage( &buf );
+        if( markers != NULL ) cvReleaseImage( &markers );
+    }
+
+    /**
+    * Set the image to be shown. Call whenever the image changes.
+    *
+    * The zoom and the pan are kept if the image size does not change,
+    * e.g., for frames of a video, or reset to fit the viewport.
+    *
+    * @param img  The image. Must be alive while it is shown.
+    */
+    void load( const IplImage* img )
+    {
+        CvSize prev = image_size();
+        src = img;
+        tiled = NULL;
+        reset( prev );
+    }
+
+    /**
+    * Set a memory mapped image to be shown
+    *
+    * @param img  The image. Must be alive while it is shown.
+    */
+    void load( IcTiledImage* img )
+    {
+        CvSize prev = image_size();
+        src = NULL;
+        tiled = img;
+        reset( prev );
+    }
+
+    bool loaded() const
+    {
+        return src != NULL || tiled != NULL;
+    }
+
+    /**
+    * @return The size of the image at the full resolution
+    */
+    CvSize image_size() const
+    {
+        return src != NULL ? cvGetSize( src ) : tiled != NULL ? tiled->size() : cvSize( 0, 0 );
+    }
+
+    /**
+    * Crop a rotated and sheared rectangle at the full resolution
+    *
+    * @see cvCropImageROI
+    * @return The cropped image. Release it.
+    */
+    IplImage* crop( CvRect32f rect32f, CvPoint2D32f shear )
+    {
+        CvRect rect = cvRectFromRect32f( rect32f );
+        if( !loaded() || rect.width <= 0 || rect.height <= 0 ) return NULL;
+        IplImage* dst;
+        if( src != NULL )
+        {
+            dst = cvCreateImage( cvSize( rect.width, rect.height ), src->depth, src->nChannels );
+            cvCropImageROI( src, dst, rect32f, shear );
+        }
+        else
+        {
+            dst = cvCreateImage( cvSize( rect.width, rect.height ), IPL_DEPTH_8U, tiled->nchannels() );
+            tiled->crop( dst, rect32f, shear );
+        }
+        return dst;
+    }
+
+    /**
+    * Show a rotated and sheared rectangle in another window
+    *
+    * A memory mapped image is sampled from the coarsest shrink level
+    * which still has max_size pixels across the rectangle.
+    *
+    * @see cvShowCroppedImage
+    */
+    void show_cropped( const char* miniw_name, CvRect32f rect32f, CvPoint2D32f shear, int max_size )
+    {
+        CvRect rect = cvRectFromRect32f( rect32f );
+        if( !loaded() || rect.width <= 0 || rect.height <= 0 ) return;
+        if( src != NULL )
+        {
+            cvShowCroppedImage( miniw_name, (IplImage*)src, rect32f, shear, max_size );
+            return;
+        }
+        int side = max( rect.width, rect.height ), shift = 0;
+        while( max_size > 0 && ( side >> ( shift + 1 ) ) >= max_size ) shift++;
+        double scale = max_size > 0 && side > max_size ? (double)max_size / side : 1.0;
+        CvSize size = cvSize( max( 1, cvRound( rect.width * scale ) ), max( 1, cvRound( rect.height * scale ) ) );
+        IplImage* preview = cvCreateImage( size, IPL_DEPTH_8U, tiled->nchannels() );
+        tiled->crop_scaled( preview, rect32f, shear, shift );
+        cvShowImage( miniw_name, preview );
+        cvReleaseImage( &preview );
+    }
+
+    /**
+    * Zoom in or out keeping the center of the viewport
+    *
+    * @param steps  Positive to zoom in, negative to zoom out. One step
+    *               is one pyramid level, i.e., twice.
+    */
+    void zoom( int steps )
+    {
+        if( !loaded() ) return;
+        CvPoint center = to_image( cvPoint( buf->width / 2, buf->height / 2 ) );
+        level = max( 0, min( fit_level(), level - steps ) );
+        CvSize size = level_size( level ), view = viewport_size( size );
+        offset = cvPoint( ( center.x >> level ) - view.width / 2, ( center.y >> level ) - view.height / 2 );
+        render();
+    }
+
+    /**
+    * Pan the viewport
+    *
+    * @param dx  Horizontal move in the fraction of the viewport width
+    * @param dy  Vertical move in the fraction of the viewport height
+    */
+    void pan( double dx, double dy )
+    {
+        if( !loaded() ) return;
+        offset.x += cvRound( dx * buf->width );
+        offset.y += cvRound( dy * buf->height );
+        render();
+    }
+
+    /**
+    * Convert window coordinates into image coordinates
+    */
+    CvPoint to_image( CvPoint pt ) const
+    {
+        return cvPoint( ( pt.x + offset.x ) << level, ( pt.y + offset.y ) << level );
+    }
+
+    /**
+    * Show the image and a rotated and sheared rectangle
+    *
+    * @see cvShowImageAndRectangle
+    */
+    void show_rectangle( CvRect32f rect32f, CvPoint2D32f shear,
+                         CvScalar color = CV_RGB(255, 255, 0), int thickness = 1 )
+    {
+        if( !loaded() ) return;
+        restore();
+        CvRect rect = cvRectFromRect32f( rect32f );
+        if( rect.width > 0 && rect.height > 0 )
+        {
+            // the affine of the rectangle in the viewport
+            float scale = 1.0f / ( 1 << level );
+            CvRect32f view32f = cvRect32f( ( rect32f.x - ( offset.x << level ) ) * scale,
+                                           ( rect32f.y - ( offset.y << level ) ) * scale,
+                                           max( 1.0f, rect32f.width * scale ),
+                                           max( 1.0f, rect32f.height * scale ), rect32f.angle );
+            CvPoint2D32f viewshear = cvPoint2D32f( shear.x * scale, shear.y * scale );
+            cvDrawRectangle( buf, view32f, viewshear, color, thickness );
+            CvPoint2D32f pt[4];
+            icvCropCorners( view32f, viewshear, pt );
+            for( int i = 0; i < 4; i++ )
+            {
+                mark_line( pt[i], pt[( i + 1 ) % 4], thickness + 2 );
+            }
+        }
+        cvShowImage( w_name, buf );
+    }
+
+    /**
+    * Show the image and the watershed region of a circle marker
+    *
+    * The watershed runs on the full resolution image. The labelling is
+    * kept until the image or the circle changes, so redrawing for the
+    * same circle, e.g., after a rotation key, does not run the watershed
+    * again.
+    *
+    * @see cvShowImageAndWatershed
+    * @return The rectangle surrounding the watershed region
+    */
+    CvRect show_watershed( const CvRect& circle )
+    {
+        if( !loaded() ) return cvRect( 0, 0, 0, 0 );
+        restore();
+        if( !has_markers || circle.x != markers_circle.x || circle.y != markers_circle.y ||
+            circle.width != markers_circle.width )
+        {
+            if( markers != NULL ) cvReleaseImage( &markers );
+            int64 start = cvGetTickCount();
+            markers = watershed( circle, &markers_roi );
+            watershed_ticks += cvGetTickCount() - start;
+            nwatershed++;
+            markers_circle = circle;
+            has_markers = true;
+        }
+        else
+        {
+            nreused++;
+        }
+        CvPoint origin = cvPoint( offset.x << level, offset.y << level );
+        CvRect rect = cvDrawWatershedCircle( buf, circle, markers, markers_roi, origin, level );
+        CvRect view = cvRect( ( rect.x - origin.x ) >> level, ( rect.y - origin.y ) >> level,
+                              rect.width >> level, rect.height >> level );
+        cvRectangle( buf, cvPoint( view.x, view.y ), cvPoint( view.x + view.width, view.y + view.height ), CV_RGB(255, 255, 0), 1 );
+        // boundaries lie within the 3 * radius disc. the rectangle surrounds them.
+        int r = ( ( 3 * abs( circle.width ) + CV_WATERSHED_PAD ) >> level ) + 2;
+        mark( cvRect( ( ( circle.x - origin.x ) >> level ) - r, ( ( circle.y - origin.y ) >> level ) - r, 2 * r + 1, 2 * r + 1 ) );
+        mark( cvRect( view.x - 1, view.y - 1, view.width + 3, view.height + 3 ) );
+        cvShowImage( w_name, buf );
+        return rect;
+    }
+
+    void print_stats( ostream& os )
+    {
+        os << "Watershed: " << nwatershed << " runs ("
+           << watershed_ticks / ( cvGetTickFrequency() * 1000.0 ) << " ms in total), "
+           << nreused << " reused." << endl;
+    }
+
+private:
+    /** Reset the view and drawings for a new image */
+    void reset( CvSize prev )
+    {
+        CvSize size = image_size();
+        bool same_size = size.width == prev.width && size.height == prev.height;
+        release_levels();
+        has_markers = false;
+        if( markers != NULL ) cvReleaseImage( &markers );
+        if( !loaded() ) return;
+        if( !same_size )
+        {
+            level = fit_level();
+            offset = cvPoint( 0, 0 );
+        }
+        render();
+    }
+
+    /** cvWatershedCircle on the full resolution image */
+    IplImage* watershed( const CvRect& circle, CvRect* roi )
+    {
+        if( src != NULL ) return cvWatershedCircle( src, circle, roi );
+        // read the region cvWatershedCircle would use
+        int r = 3 * abs( circle.width ) + CV_WATERSHED_PAD;
+        CvSize size = tiled->size();
+        int x1 = max( 0, circle.x - r ), y1 = max( 0, circle.y - r );
+        int x2 = min( size.width, circle.x + r + 1 ), y2 = min( size.height, circle.y + r + 1 );
+        *roi = cvRect( 0, 0, 0, 0 );
+        if( x1 >= x2 || y1 >= y2 || tiled->nchannels() != 3 ) return NULL;
+        IplImage* region = tiled->read( cvRect( x1, y1, x2 - x1, y2 - y1 ) );
+        IplImage* labels = cvWatershedCircle( region, cvRect( circle.x - x1, circle.y - y1, circle.width, 0 ), roi );
+        roi->x += x1;
+        roi->y += y1;
+        cvReleaseImage( &region );
+        return labels;
+    }
+
+    /** Size of a pyramid level as cvPyrDown makes */
+    CvSize level_size( int l ) const
+    {
+        CvSize size = image_size();
+        for( int i = 0; i < l; i++ ) size = cvSize( ( size.width + 1 ) / 2, ( size.height + 1 ) / 2 );
+        return size;
+    }
+
+    /** The finest level which fits in the viewport */
+    int fit_level() const
+    {
+        int l = 0;
+        CvSize size = image_size();
+        while( ( view_size.width > 0 && size.width > view_size.width ) ||
+               ( view_size.height > 0 && size.height > view_size.height ) )
+        {
+            if( size.width == 1 && size.height == 1 ) break;
+            size = cvSize( ( size.width + 1 ) / 2, ( size.height + 1 ) / 2 );
+            l++;
+        }
+        return l;
+    }
+
+    CvSize viewport_size( CvSize size ) const
+    {
+        return cvSize( view_size.width > 0 ? min( size.width, view_size.width ) : size.width,
+                       view_size.height > 0 ? min( size.height, view_size.height ) : size.height );
+    }
+
+    /** A pyramid level, built from the previous level if not yet */
+    const IplImage* get_level( int l )
+    {
+        if( l == 0 ) return src;
+        if( (int)levels.size() < l ) levels.resize( l, (IplImage*)NULL );
+        if( levels[l - 1] == NULL )
+        {
+            const IplImage* prev = get_level( l - 1 );
+            levels[l - 1] = cvCreateImage( cvSize( ( prev->width + 1 ) / 2, ( prev->height + 1 ) / 2 ),
+                                           prev->depth, prev->nChannels );
+            cvPyrDown( prev, levels[l - 1] );
+        }
+        return levels[l - 1];
+    }
+
+    void release_levels()
+    {
+        for( size_t i = 0; i < levels.size(); i++ )
+        {
+            if( levels[i] != NULL ) cvReleaseImage( &levels[i] );
+        }
+        levels.clear();
+    }
+
+    /** Copy the whole viewport into the buffer */
+    void render()
+    {
+        CvSize size = level_size( level );
+        CvSize view = viewport_size( size );
+        int depth = src != NULL ? src->depth : IPL_DEPTH_8U;
+        int nchannels = src != NULL ? src->nChannels : tiled->nchannels();
+        offset.x = max( 0, min( size.width - view.width, offset.x ) );
+        offset.y = max( 0, min( size.height - view.height, offset.y ) );
+        if( buf != NULL && ( buf->width != view.width || buf->height != view.height ||
+                             buf->depth != depth || buf->nChannels != nchannels ) )
+        {
+            cvReleaseImage( &buf );
+        }
+        if( buf == NULL ) buf = cvCreateImage( view, depth, nchannels );
+        dirty.clear();
+        dirty.push_back( cvRect( 0, 0, view.width, view.height ) );
+        restore();
+    }
+
+    /** Copy the regions drawn last time back from the level */
+    void restore()
+    {
+        for( size_t i = 0; i < dirty.size(); i++ )
+        {
+            CvMat to;
+            CvRect from = cvRect( dirty[i].x + offset.x, dirty[i].y + offset.y, 
+                                  dirty[i].width, dirty[i].height );
+            cvGetSubRect( buf, &to, dirty[i] );
+            if( tiled != NULL )
+            {
+                tiled->read( from, &to, level );
+            }
+            else
+            {
+                CvMat sub;
+                cvGetSubRect( get_level( level ), &sub, from );
+                cvCopy( &sub, &to );
+            }
+        }
+        dirty.clear();
+    }
+
+    /** Record a region to be restored, clipped by the viewport */
+    void mark( CvRect rect )
+    {
+        int x1 = max( 0, rect.x ), y1 = max( 0, rect.y );
+        int x2 = min( buf->width, rect.x + rect.width );
+        int y2 = min( buf->height, rect.y + rect.height );
+        if( x1 >= x2 || y1 >= y2 ) return;
+        dirty.push_back( cvRect( x1, y1, x2 - x1, y2 - y1 ) );
+    }
+
+    /**
+    * Record a line as bounding boxes of short pieces so that a slanted
+    * line does not mark its whole bounding box
+    */
+    void mark_line( CvPoint2D32f p, CvPoint2D32f q, int pad )
+    {
+        const double piece = 16;
+        double len = sqrt( (double)( q.x - p.x ) * ( q.x - p.x ) + (double)( q.y - p.y ) * ( q.y - p.y ) );
+        int n = max( 1, (int)ceil( len / piece ) );
+        for( int i = 0; i < n; i++ )
+        {
+            double ax = p.x + ( q.x - p.x ) * i / n,       ay = p.y + ( q.y - p.y ) * i / n;
+            double bx = p.x + ( q.x - p.x ) * ( i + 1 ) / n, by = p.y + ( q.y - p.y ) * ( i + 1 ) / n;
+            int x1 = cvFloor( min( ax, bx ) ) - pad, y1 = cvFloor( min( ay, by ) ) - pad;
+            int x2 = cvCeil( max( ax, bx ) ) + pad,  y2 = cvCeil( max( ay, by ) ) + pad;
+            mark( cvRect( x1, y1, x2 - x1 + 1, y2 - y1 + 1 ) );
+        }
+    }
+
+    const char* w_name;
+    CvSize view_size;        /**< maximum viewport size */
+    const IplImage* src;     /**< image shown */
+    IcTiledImage* tiled;     /**< memory mapped image shown instead of src */
+    vector<IplImage*> levels;/**< levels[l - 1] is the pyramid level l, or NULL if not built */
+    IplImage* buf;           /**< viewport with drawings */
+    int level;               /**< pyramid level shown */
+    CvPoint offset;          /**< top-left of the viewport in the level */
+    vector<CvRect> dirty;    /**< regions of buf which differ from the level */
+    IplImage* markers;       /**< watershed labels of markers_roi for markers_circle */
+    CvRect markers_roi;
+    CvRect markers_circle;
+    bool has_markers;
+    int64 watershed_ticks;   /**< time spent in cvWatershedCircle */
+    int nwatershed;
+    int nreused;
+};
+
+#endif
@@ -29,7 +29,310 @@
 #define IC_FORMAT_INCLUDED
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <string>
+#include <vector>
+
+/**
+* An output file path format compiled once
+*
+* The format (see icFormat) is parsed into a program of literal and
+* conversion tokens, so that rendering a path is a single pass which
+* appends to one buffer reserved up front. %d, %i, %e and zero padded
+* integers such as %04x are rendered without sprintf.
+*/
+class IcFormat {
+public:
+    IcFormat() : nliteral( 0 ), nint( 0 )
+    {
+        nstr[0] = nstr[1] = nstr[2] = 0;
+    }
+
+    explicit IcFormat( const std::string& format ) : nliteral( 0 ), nint( 0 )
+    {
+        nstr[0] = nstr[1] = nstr[2] = 0;
+        compile( format );
+    }
+
+    /**
+    * Render a path
+    *
+    * @see icFormat
+    */
+    std::string operator()( const std::string& dirname, const std::string& filename, const std::string& extension,
+                            int x, int y, int width, int height, int frame = 0, int rotation = 0,
+                            int shear_x = 0, int shear_y = 0 ) const
+    {
+        const std::string* strvals[] = { &filename, &extension, &dirname };
+        int intvals[] = { x, y, width, height, frame, rotation, shear_x, shear_y };
+        std::string ret;
+        ret.reserve( nliteral + nint * 11 + nstr[0] * filename.size() + nstr[1] * extension.size() +
+                     nstr[2] * dirname.size() );
+        for( size_t i = 0; i < tokens.size(); i++ )
+        {
+            const Token& token = tokens[i];
+            if( token.type == LITERAL )
+            {
+                ret.append( literals, token.begin, token.length );
+            }
+            else if( token.type == STRING && token.spec.empty() )
+            {
+                ret.append( *strvals[token.key] );
+            }
+            else if( token.type == INTEGER && token.spec.empty() )
+            {
+                append_int( ret, intvals[token.key], token.width, token.zero );
+            }
+            else // any other printf conversion
+            {
+                size_t bound = token.bound + ( token.type == STRING ? strvals[token.key]->size() : 0 );
+                char tmp[64];
+                std::vector<char> buf;
+                char* out = tmp;
+                if( bound > sizeof( tmp ) )
+                {
+                    buf.resize( bound );
+                    out = &buf[0];
+                }
+                int n = token.type == STRING ?
+                    sprintf( out, token.spec.c_str(), strvals[token.key]->c_str() ) :
+                    sprintf( out, token.spec.c_str(), intvals[token.key] );
+                if( n > 0 ) ret.append( out, n );
+            }
+        }
+        return ret;
+    }
+
+    /**
+    * Parse a filename made by the part of the format after its last
+    * directory separator, the inverse of operator()
+    *
+    * Tokens are matched from the right. An integer takes [-]digits, a
+    * string takes the text after the rightmost occurrence of the literal
+    * before it, and the first token takes the rest.
+    *
+    * @param name       The filename
+    * @param filename   %i if in the format
+    * @param extension  %e if in the format
+    * @param intvals    x, y, width, height, frame, rotation, shear_x, shear_y.
+    *                   0 if not in the format.
+    * @param keys       A bit per value in the order of intvals, then
+    *                   (1 << 8) for %i and (1 << 9) for %e, set if parsed
+    * @return false if the name is not made by the format
+    */
+    bool parse( const std::string& name, std::string& filename, std::string& extension,
+                int intvals[8], unsigned int& keys ) const
+    {
+        for( int k = 0; k < 8; k++ ) intvals[k] = 0;
+        keys = 0;
+        // the tokens of the filename, from the literal with the last separator
+        size_t first = 0, skip = 0;
+        for( size_t i = tokens.size(); i > 0; i-- )
+        {
+            const Token& token = tokens[i - 1];
+            if( token.type == STRING && token.key == 2 ) // %d
+            {
+                first = i;
+                break;
+            }
+            if( token.type != LITERAL ) continue;
+            std::string::size_type slash = literals.find_last_of( "/\\", token.begin + token.length - 1 );
+            if( slash != std::string::npos && slash >= token.begin )
+            {
+                first = i - 1;
+                skip = slash + 1 - token.begin;
+                if( skip == token.length ) // nothing of the filename
+                {
+                    first = i;
+                    skip = 0;
+                }
+                break;
+            }
+        }
+        size_t end = name.size();
+        for( size_t i = tokens.size(); i > first; i-- )
+        {
+            const Token& token = tokens[i - 1];
+            bool leftmost = ( i - 1 == first );
+            if( token.type == LITERAL )
+            {
+                size_t offset = leftmost ? skip : 0;
+                size_t length = token.length - offset;
+                if( end < length || name.compare( end - length, length, literals, token.begin + offset, length ) != 0 )
+                    return false;
+                end -= length;
+            }
+            else if( token.type == INTEGER )
+            {
+                size_t begin = end;
+                while( begin > 0 && name[begin - 1] >= '0' && name[begin - 1] <= '9' ) begin--;
+                if( begin == end ) return false;
+                // a minus sign unless it is the end of the literal before
+                if( begin > 0 && name[begin - 1] == '-' &&
+                    ( leftmost || !literal_ends_with( tokens[i - 2], '-' ) || ( begin > 1 && name[begin - 2] == '-' ) ) )
+                    begin--;
+                intvals[token.key] = atoi( name.substr( begin, end - begin ).c_str() );
+                keys |= 1u << token.key;
+                end = begin;
+            }
+            else
+            {
+                size_t begin = 0;
+                if( !leftmost )
+                {
+                    const Token& prev = tokens[i - 2];
+                    if( prev.type != LITERAL ) return false; // adjacent conversions are ambiguous
+                    size_t offset = ( i - 2 == first ) ? skip : 0;
+                    std::string literal( literals, prev.begin + offset, prev.length - offset );
+                    if( end < literal.size() ) return false;
+                    std::string::size_type found = name.rfind( literal, end - literal.size() );
+                    if( found == std::string::npos ) return false;
+                    begin = found + literal.size();
+                }
+                if( token.key == 0 ) filename.assign( name, begin, end - begin );
+                if( token.key == 1 ) extension.assign( name, begin, end - begin );
+                if( token.key < 2 ) keys |= 1u << ( 8 + token.key );
+                end = begin;
+            }
+        }
+        return end == 0;
+    }
+
+private:
+    enum TokenType { LITERAL, STRING, INTEGER };
+
+    struct Token {
+        TokenType type;
+        int key;                /**< index of the value */
+        size_t begin;           /**< of a literal in literals */
+        size_t length;
+        std::string spec;       /**< printf conversion, empty if rendered natively */
+        size_t bound;           /**< bytes a printf conversion may take besides a string */
+        int width;              /**< of a native integer */
+        bool zero;              /**< zero padding of a native integer */
+    };
+
+    /**
+    * Parse the format as icFormat always did: the conversion of a % is up
+    * to the nearest key character after it, and at most 11 conversions
+    * are made. Unlike icFormat, a % which a conversion produces, e.g., of
+    * %% or in a filename, is not converted again.
+    */
+    void compile( const std::string& format )
+    {
+        static const char intkeys[] = { 'x', 'y', 'w', 'h', 'f', 'r', '.', ',' };
+        static const char strkeys[] = { 'i', 'e', 'd' };
+        const int nintkeys = 8, nstrkeys = 3;
+        literals = format;
+        size_t pos = 0;
+        for( int i = 0; i < nintkeys + nstrkeys; i++ )
+        {
+            std::string::size_type start = format.find( '%', pos );
+            if( start == std::string::npos ) break;
+            std::string::size_type end = format.find_first_of( std::string( strkeys, nstrkeys ) +
+                                                               std::string( intkeys, nintkeys ), start );
+            if( end == std::string::npos ) break;
+            add_literal( pos, start - pos );
+            Token token;
+            token.begin = token.length = token.bound = 0;
+            token.width = 0;
+            token.zero = false;
+            const char* strkey = (const char*)memchr( strkeys, format[end], nstrkeys );
+            if( strkey != NULL )
+            {
+                token.type = STRING;
+                token.key = (int)( strkey - strkeys );
+                nstr[token.key]++;
+                if( end - start > 1 ) token.spec = format.substr( start, end - start ) + "s";
+            }
+            else
+            {
+                token.type = INTEGER;
+                token.key = (int)( (const char*)memchr( intkeys, format[end], nintkeys ) - intkeys );
+                nint++;
+                if( !parse_width( format.substr( start + 1, end - start - 1 ), token.width, token.zero ) )
+                {
+                    token.spec = format.substr( start, end - start ) + "d";
+                }
+            }
+            if( !token.spec.empty() ) token.bound = max_number( token.spec ) + 32;
+            tokens.push_back( token );
+            pos = end + 1;
+        }
+        add_literal( pos, format.size() - pos );
+    }
+
+    void add_literal( size_t begin, size_t length )
+    {
+        if( length == 0 ) return;
+        Token token;
+        token.type = LITERAL;
+        token.key = 0;
+        token.begin = begin;
+        token.length = length;
+        token.bound = 0;
+        token.width = 0;
+        token.zero = false;
+        tokens.push_back( token );
+        nliteral += length;
+    }
+
+    bool literal_ends_with( const Token& token, char c ) const
+    {
+        return token.type == LITERAL && literals[token.begin + token.length - 1] == c;
+    }
+
+    /** Parse flags and width of the form [0][width] */
+    static bool parse_width( const std::string& spec, int& width, bool& zero )
+    {
+        size_t i = 0;
+        zero = ( !spec.empty() && spec[0] == '0' );
+        if( zero ) i++;
+        width = 0;
+        for( ; i < spec.size(); i++ )
+        {
+            if( spec[i] < '0' || spec[i] > '9' || width > 1000 ) return false;
+            width = width * 10 + ( spec[i] - '0' );
+        }
+        return true;
+    }
+
+    /** The largest width or precision of a printf conversion */
+    static size_t max_number( const std::string& spec )
+    {
+        size_t largest = 0, number = 0;
+        for( size_t i = 0; i < spec.size(); i++ )
+        {
+            number = ( spec[i] >= '0' && spec[i] <= '9' ) ? number * 10 + ( spec[i] - '0' ) : 0;
+            largest = number > largest ? number : largest;
+        }
+        return largest;
+    }
+
+    static void append_int( std::string& ret, int value, int width, bool zero )
+    {
+        char digits[16];
+        int n = 0;
+        unsigned int v = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+        do
+        {
+            digits[n++] = (char)( '0' + v % 10 );
+            v /= 10;
+        } while( v > 0 );
+        int length = n + ( value < 0 ? 1 : 0 );
+        if( !zero && width > length ) ret.append( width - length, ' ' );
+        if( value < 0 ) ret.push_back( '-' );
+        if( zero && width > length ) ret.append( width - length, '0' );
+        while( n > 0 ) ret.push_back( digits[--n] );
+    }
+
+    std::string literals;       /**< the format, referred by literal tokens */
+    std::vector<Token> tokens;
+    size_t nliteral;            /**< bytes of literals */
+    size_t nint;                /**< integer conversions */
+    size_t nstr[3];             /**< conversions of each string */
+};
 
 /**
 * Convert format to string
@@ -58,50 +361,12 @@
 * @param shear_x
 * @param shear_y
 * @return string
+* @see IcFormat to render many paths of a format
 */
 string icFormat(const string& format, const string& dirname, const string& filename, const string& extension, 
                int x, int y, int width, int height, int frame = 0, int rotation = 0, int shear_x = 0, int shear_y = 0)
 {
-    string ret = format;
-    char tmp[2048];
-    char intkeys[] = { 'x', 'y', 'w', 'h', 'f', 'r', '.', ',' };
-    int  intvals[] = { x, y, width, height, frame, rotation, shear_x, shear_y };
-    int nintkeys = 8;
-    char strkeys[] = { 'i', 'e', 'd' };
-    std::string strvals[] = { filename, extension, dirname };
-    int nstrkeys = 3;
-    for(int i = 0; i < nintkeys + nstrkeys; i++) {
-        std::string::size_type start = ret.find("%");
-        if(start == std::string::npos) break;
-        std::string::size_type minstrpos = std::string::npos;
-        std::string::size_type minintpos = std::string::npos;
-        int minstrkey = INT_MAX; int minintkey = INT_MAX;
-        for(int j = 0; j < nstrkeys; j++) {
-            std::string::size_type pos = ret.find(strkeys[j], start);
-            if(pos < minstrpos) {
-                minstrpos = pos;
-                minstrkey = j;
-            }
-        }
-        for(int j = 0; j < nintkeys; j++) {
-            std::string::size_type pos = ret.find(intkeys[j], start);
-            if(pos < minintpos) {
-                minintpos = pos;
-                minintkey = j;
-            }
-        }
-        if(minstrpos == std::string::npos && minintpos == std::string::npos) break;
-        if(minstrpos < minintpos) {
-            string format_substr = ret.substr(start, minstrpos - start) + "s";
-            std::sprintf(tmp, format_substr.c_str(), strvals[minstrkey].c_str());
-            ret.replace(start, minstrpos - start + 1, string(tmp));
-        } else {
-            string format_substr = ret.substr(start, minintpos - start) + "d";
-            std::sprintf(tmp, format_substr.c_str(), intvals[minintkey]);
-            ret.replace(start, minintpos - start + 1, string(tmp));
-        }
-    }
-    return ret;
+    return IcFormat( format )( dirname, filename, extension, x, y, width, height, frame, rotation, shear_x, shear_y );
 }
 
 #endif
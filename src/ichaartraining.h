@@ -0,0 +1,257 @@
+/** @file
+*
+* Image clipper OpenCV haartraining positives writer
+*
+* The MIT License
+*
+* Copyright (c) 2008, Naotoshi Seo <sonots(at)umd.edu>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#ifndef IC_HAARTRAINING_INCLUDED
+#define IC_HAARTRAINING_INCLUDED
+
+#include "cxcore.h"
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <boost/unordered_map.hpp>
+#include <boost/thread.hpp>
+#include "filesystem.h"
+#include "icformat.h"
+using namespace std;
+
+/**
+* Aggregate clipped regions into the OpenCV haartraining format
+*
+*   image.jpg 2 68 47 89 101 87 66 90 80
+*
+* i.e., what haartrainingformat.pl --ls --trim --basename makes of the
+* clipped image names, without listing and sorting all of the names.
+* Regions are grouped by their source image through a hash map. A group
+* is a fixed size record linking its regions in one shared array, so the
+* memory is constant per group besides 20 bytes per region.
+*
+* Lines are sorted by image, and the regions of an image by x, y, width
+* and height, so that the output does not depend on the order regions
+* were added in. add() may be called from multiple threads.
+*
+* haartraining takes upright rectangles only, so rotated or sheared
+* regions are skipped (and counted) rather than written as a rectangle
+* which does not match the clipped pixels.
+*/
+class IcHaarTrainingWriter {
+public:
+    IcHaarTrainingWriter() : nskipped( 0 ) {}
+
+    /**
+    * @param source            The image the region was clipped from. It is
+    *                          written by its filename without the directory,
+    *                          as haartrainingformat.pl --basename does, so
+    *                          that --batch, the GUI and --collect agree.
+    * @param rect              The region
+    * @param [rotation = 0]    The rotation. Skipped unless 0.
+    * @param [shear = (0, 0)]  The shear deformation. Skipped unless 0.
+    * @return false if skipped
+    */
+    bool add( const string& source, CvRect rect, int rotation = 0, CvPoint shear = cvPoint( 0, 0 ) )
+    {
+        string name = filesystem::basename( source );
+        boost::mutex::scoped_lock lock( mutex );
+        if( rotation != 0 || shear.x != 0 || shear.y != 0 )
+        {
+            nskipped++;
+            return false;
+        }
+        Region region = { rect.x, rect.y, rect.width, rect.height, -1 };
+        int index = (int)regions.size();
+        regions.push_back( region );
+        Group& group = groups[name]; // empty if new
+        if( group.count++ == 0 )
+            group.first = index;
+        else
+            regions[group.last].next = index;
+        group.last = index;
+        return true;
+    }
+
+    /**
+    * Parse the name of a clipped image and add its region
+    *
+    * @see parse_clipped
+    * @return false if the name is not of a clipped image or skipped
+    */
+    bool add_clipped( const string& name, const IcFormat& format )
+    {
+        string source;
+        CvRect rect;
+        int rotation;
+        CvPoint shear;
+        if( !parse_clipped( name, format, source, rect, rotation, shear ) ) return false;
+        return add( source, rect, rotation, shear );
+    }
+
+    /**
+    * Add all images clipped in a directory in one pass, without stat()ing
+    *
+    * @param dirpath     The directory of clipped images
+    * @param extensions  The image file types
+    * @param format      The output format the images were clipped by
+    * @return the number of images added
+    */
+    int collect( const string& dirpath, const filesystem::extension_set& extensions, const IcFormat& format )
+    {
+        int n = 0;
+        boost::filesystem::directory_iterator iter( dirpath ), end_iter;
+        for( ; iter != end_iter; ++iter )
+        {
+            string name = iter->path().leaf();
+            if( extensions.match( name ) && add_clipped( name, format ) ) n++;
+        }
+        return n;
+    }
+
+    /** @return the number of regions */
+    size_t size() const
+    {
+        return regions.size();
+    }
+
+    /** @return the number of rotated or sheared regions skipped */
+    size_t skipped() const
+    {
+        return nskipped;
+    }
+
+    /**
+    * @param fp  The output stream
+    * @return false on write errors
+    */
+    bool write( FILE* fp ) const
+    {
+        vector<const GroupMap::value_type*> sorted;
+        sorted.reserve( groups.size() );
+        for( GroupMap::const_iterator it = groups.begin(); it != groups.end(); ++it )
+        {
+            sorted.push_back( &*it );
+        }
+        sort( sorted.begin(), sorted.end(), source_less );
+        vector<Region> group_regions;
+        for( size_t i = 0; i < sorted.size(); i++ )
+        {
+            const Group& group = sorted[i]->second;
+            group_regions.clear();
+            for( int r = group.first; r >= 0; r = regions[r].next )
+            {
+                group_regions.push_back( regions[r] );
+            }
+            sort( group_regions.begin(), group_regions.end(), region_less );
+            fprintf( fp, "%s %d", sorted[i]->first.c_str(), group.count );
+            for( size_t j = 0; j < group_regions.size(); j++ )
+            {
+                const Region& r = group_regions[j];
+                fprintf( fp, " %d %d %d %d", r.x, r.y, r.width, r.height );
+            }
+            fputc( '\n', fp );
+        }
+        return !ferror( fp );
+    }
+
+    /**
+    * @param path  The output file. "-" for stdout.
+    * @return false on errors
+    */
+    bool write( const string& path ) const
+    {
+        if( path == "-" ) return write( stdout ) && fflush( stdout ) == 0;
+        FILE* fp = fopen( path.c_str(), "w" );
+        if( fp == NULL ) return false;
+        bool ok = write( fp );
+        return ( fclose( fp ) == 0 ) && ok;
+    }
+
+    /**
+    * Parse a clipped image name made by an output format with %i, %x, %y,
+    * %w and %h, e.g., image.jpg_0000_0068_0047_0089_0101.png of the default
+    * %d/imageclipper/%i.%e_%04r_%04x_%04y_%04w_%04h.png
+    *
+    * @see IcFormat::parse
+    * @param name       The clipped image name
+    * @param format     The output format
+    * @param source     The source image name, %i.%e, or %i if the format has no %e
+    * @param rect       The region, e.g., 68 47 89 101
+    * @param rotation   %r, 0 if the format has no %r
+    * @param shear      %. and %,, 0 if not in the format
+    * @return false if the name is not of the format
+    */
+    static bool parse_clipped( const string& name, const IcFormat& format, string& source, CvRect& rect,
+                               int& rotation, CvPoint& shear )
+    {
+        string stem, extension;
+        int values[8];
+        unsigned int keys;
+        const unsigned int required = ( 1u << 8 ) | 0xf; // %i %x %y %w %h
+        if( !format.parse( name, stem, extension, values, keys ) || ( keys & required ) != required ) return false;
+        source = ( keys & ( 1u << 9 ) ) ? stem + "." + extension : stem;
+        rect = cvRect( values[0], values[1], values[2], values[3] );
+        rotation = values[5];
+        shear = cvPoint( values[6], values[7] );
+        return !source.empty();
+    }
+
+private:
+    struct Region {
+        int x;
+        int y;
+        int width;
+        int height;
+        int next;       /**< next region of the group, -1 for the last */
+    };
+
+    struct Group {
+        Group() : first( -1 ), last( -1 ), count( 0 ) {}
+        int first;      /**< first region */
+        int last;       /**< last region, where to link a new one */
+        int count;
+    };
+
+    typedef boost::unordered_map<string, Group> GroupMap;
+
+    static bool source_less( const GroupMap::value_type* a, const GroupMap::value_type* b )
+    {
+        return a->first < b->first;
+    }
+
+    static bool region_less( const Region& a, const Region& b )
+    {
+        if( a.x != b.x ) return a.x < b.x;
+        if( a.y != b.y ) return a.y < b.y;
+        if( a.width != b.width ) return a.width < b.width;
+        return a.height < b.height;
+    }
+
+    vector<Region> regions;
+    GroupMap groups;
+    size_t nskipped;
+    boost::mutex mutex;     /**< guards regions, groups and nskipped in add() */
+};
+
+#endif
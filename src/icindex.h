@@ -0,0 +1,409 @@
+/** @file
+*
+* Image clipper persistent index of directory listings
+*
+* The MIT License
+*
+* Copyright (c) 2008, Naotoshi Seo <sonots(at)umd.edu>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#ifndef IC_INDEX_INCLUDED
+#define IC_INDEX_INCLUDED
+
+#include <stdio.h>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <boost/filesystem.hpp>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include "filesystem.h"
+#include "icthreadpool.h"
+using namespace std;
+
+/**
+* A sorted list of image files in a directory kept in an index file
+*
+* Listing a huge directory (on NFS especially) is slow because each entry
+* is stat()ed to see whether it is a regular file. The list is saved to an
+* index file together with the modification time of the directory. While
+* the directory is not modified, the list is restored from the index
+* without reading the directory. Otherwise the directory is read again
+* but only entries not in the index are stat()ed, and the index is
+* rewritten.
+*
+* The mtime has a resolution of a second, so an index is trusted only if
+* it was confirmed in a later second than the mtime. Files added while the
+* index is being written may be missed until the directory is modified
+* again.
+*
+* When subdirectories are listed too, they are indexed as names ending
+* with '/', and entries which are neither images nor indexed are stat()ed
+* on every refresh.
+*/
+class IcFileIndex {
+public:
+    /**
+    * @param dirpath       The directory
+    * @param extensions    The image file types
+    * @param [index_path = ""]
+    *                      The index file. "" not to keep an index.
+    * @param [subdirs = false]
+    *                      List subdirectories too (symbolic links are not)
+    */
+    IcFileIndex( const string& dirpath, const vector<string>& extensions, const string& index_path = "",
+                 bool subdirs = false )
+        : dirpath( dirpath ), extensions( extensions ), imset( extensions ), index_path( index_path ),
+          subdirs( subdirs ), restored( false ), unwritable( false ), nstat( 0 )
+    {
+        boost::filesystem::path fs_dirpath( dirpath );
+        if( !boost::filesystem::exists( fs_dirpath ) || !boost::filesystem::is_directory( fs_dirpath ) )
+        {
+            return;
+        }
+        time_t dir_mtime = filesystem::mtime( dirpath );
+        time_t confirmed = 0, indexed_mtime = 0;
+        bool loaded = !index_path.empty() && load( indexed_mtime, confirmed );
+        if( loaded ) restored = ( indexed_mtime == dir_mtime && dir_mtime < confirmed );
+        if( !restored )
+        {
+            bool changed = refresh();
+            if( !index_path.empty() )
+            {
+                if( !loaded || changed || indexed_mtime != dir_mtime )
+                    unwritable = !save();
+                else
+                    unwritable = !confirm( dir_mtime ); // in place, not to modify the directory
+            }
+        }
+        files.reserve( names.size() );
+        boost::shared_ptr<const string> dir;
+        for( size_t i = 0; i < names.size(); i++ )
+        {
+            const string& name = names[i];
+            if( name[name.size() - 1] == '/' )
+            {
+                dirs.push_back( ( fs_dirpath / name.substr( 0, name.size() - 1 ) ).native_file_string() );
+                continue;
+            }
+            string path = ( fs_dirpath / name ).native_file_string();
+            if( !dir ) dir.reset( new string( filesystem::dirname( path ) ) );
+            files.push_back( filesystem::decompose( path, name, dir ) );
+        }
+    }
+
+    /** @return The files sorted by name */
+    const vector<filesystem::file_entry>& filelist() const
+    {
+        return files;
+    }
+
+    /** @return The subdirectory paths if listed */
+    const vector<string>& dirlist() const
+    {
+        return dirs;
+    }
+
+    /** @return true if the list was restored without reading the directory */
+    bool up_to_date() const
+    {
+        return restored;
+    }
+
+    /** @return The number of entries stat()ed */
+    int stat_count() const
+    {
+        return nstat;
+    }
+
+    /** @return true if the index file could not be written */
+    bool unwritable_index() const
+    {
+        return unwritable;
+    }
+
+private:
+    /**
+    * Read the directory, stat()ing only entries not in names, and replace
+    * names with the sorted entries
+    *
+    * @return false if names did not change
+    */
+    bool refresh()
+    {
+        vector<string> listed;
+        boost::filesystem::directory_iterator iter( dirpath ), end_iter;
+        for( ; iter != end_iter; ++iter )
+        {
+            string name = iter->path().leaf();
+            bool image = imset.match( name );
+            if( !image && !subdirs ) continue;
+            if( image && binary_search( names.begin(), names.end(), name ) )
+            {
+                listed.push_back( name );
+                continue;
+            }
+            if( subdirs && binary_search( names.begin(), names.end(), name + "/" ) )
+            {
+                listed.push_back( name + "/" );
+                continue;
+            }
+            nstat++;
+            if( image && boost::filesystem::is_regular( iter->path() ) )
+            {
+                listed.push_back( name );
+            }
+            else if( subdirs && boost::filesystem::is_directory( iter->path() ) &&
+                     !boost::filesystem::is_symlink( iter->path() ) )
+            {
+                listed.push_back( name + "/" );
+            }
+        }
+        sort( listed.begin(), listed.end() );
+        bool changed = ( listed != names );
+        names.swap( listed );
+        return changed;
+    }
+
+    /**
+    * Restore names from the index file
+    *
+    * The index is a header of four lines, a signature, the directory, its
+    * mtime and the time the index was confirmed, and the image file types,
+    * followed by the sorted file names one per line.
+    */
+    bool load( time_t& dir_mtime, time_t& confirmed )
+    {
+        FILE* fp = fopen( index_path.c_str(), "rb" );
+        if( fp == NULL ) return false;
+        string buf;
+        char chunk[65536];
+        size_t n;
+        while( ( n = fread( chunk, 1, sizeof( chunk ), fp ) ) > 0 ) buf.append( chunk, n );
+        fclose( fp );
+
+        vector<string> lines;
+        size_t begin = 0, end;
+        while( ( end = buf.find( '\n', begin ) ) != string::npos )
+        {
+            lines.push_back( buf.substr( begin, end - begin ) );
+            begin = end + 1;
+        }
+        long m, w;
+        if( lines.size() < 4 || lines[0] != signature() || lines[1] != dirpath ||
+            lines[3] != joined_extensions() || sscanf( lines[2].c_str(), "%ld %ld", &m, &w ) != 2 )
+        {
+            return false;
+        }
+        dir_mtime = (time_t)m;
+        confirmed = (time_t)w;
+        names.assign( lines.begin() + 4, lines.end() );
+        return true;
+    }
+
+    /**
+    * Write names to the index file
+    *
+    * @return false if it could not be written
+    */
+    bool save()
+    {
+        string tmp_path = index_path + ".tmp";
+        FILE* fp = fopen( tmp_path.c_str(), "wb" );
+        if( fp == NULL ) return false;
+        fprintf( fp, "%s\n%s\n%20ld %20ld\n%s\n", signature().c_str(), dirpath.c_str(),
+                 0L, 0L, joined_extensions().c_str() );
+        for( size_t i = 0; i < names.size(); i++ )
+        {
+            fwrite( names[i].data(), 1, names[i].size(), fp );
+            fputc( '\n', fp );
+        }
+        bool ok = !ferror( fp );
+        ok = ( fclose( fp ) == 0 ) && ok;
+        if( ok && rename( tmp_path.c_str(), index_path.c_str() ) != 0 )
+        {
+            // rename does not overwrite on Windows
+            remove( index_path.c_str() );
+            ok = ( rename( tmp_path.c_str(), index_path.c_str() ) == 0 );
+        }
+        if( !ok )
+        {
+            remove( tmp_path.c_str() );
+            return false;
+        }
+        // the index may be in the directory, so its mtime is taken after
+        return confirm( filesystem::mtime( dirpath ) );
+    }
+
+    /**
+    * Overwrite the mtime and the confirmed time of the index file
+    *
+    * @return false if it could not be written
+    */
+    bool confirm( time_t dir_mtime )
+    {
+        FILE* fp = fopen( index_path.c_str(), "r+b" );
+        if( fp == NULL ) return false;
+        bool ok = fseek( fp, (long)( signature().size() + 1 + dirpath.size() + 1 ), SEEK_SET ) == 0 &&
+            fprintf( fp, "%20ld %20ld", (long)dir_mtime, (long)time( NULL ) ) == 41;
+        ok = ( fclose( fp ) == 0 ) && ok;
+        return ok;
+    }
+
+    string signature() const
+    {
+        return subdirs ? "imageclipper file index 1 subdirs" : "imageclipper file index 1";
+    }
+
+    string joined_extensions() const
+    {
+        string joined;
+        for( size_t i = 0; i < extensions.size(); i++ )
+        {
+            joined += ( i > 0 ? " " : "" ) + extensions[i];
+        }
+        return joined;
+    }
+
+    string dirpath;
+    vector<string> extensions;
+    filesystem::extension_set imset;
+    string index_path;
+    bool subdirs;
+    vector<string> names;   /**< sorted file names in dirpath, subdirectories end with '/' */
+    vector<filesystem::file_entry> files; /**< sorted files */
+    vector<string> dirs;    /**< sorted subdirectory paths */
+    bool restored;          /**< the index was up to date */
+    bool unwritable;        /**< the index could not be written */
+    int nstat;              /**< entries stat()ed */
+};
+
+/**
+* A natural sorted list of image files under a directory
+*
+* Each directory is listed through its IcFileIndex. With recursion, every
+* subdirectory found becomes a task of a thread pool, so that directories
+* are read concurrently (which hides the latency of network file systems),
+* and the results are merged and sorted at the end. The order therefore
+* does not depend on the file system nor on the scheduling.
+*/
+class IcDirectoryScan {
+public:
+    /**
+    * @param extensions        The image file types
+    * @param [index = ""]      The index file of each directory (see index_path)
+    * @param [recursive = false]
+    *                          Scan subdirectories too
+    * @param [nthreads = 0]    The number of threads to scan subdirectories.
+    *                          0 for the number of cores.
+    */
+    IcDirectoryScan( const vector<string>& extensions, const string& index = "",
+                     bool recursive = false, int nthreads = 0 )
+        : extensions( extensions ), index( index ), recursive( recursive ), nthreads( nthreads ),
+          ndirs( 0 ), nrestored( 0 ), nstat( 0 ), nunwritable( 0 )
+    {
+    }
+
+    /**
+    * @param dirpath  The directory
+    * @return The files in natural order
+    */
+    vector<filesystem::file_entry> scan( const string& dirpath )
+    {
+        files.clear();
+        ndirs = nrestored = nstat = nunwritable = 0;
+        if( recursive )
+        {
+            IcThreadPool pool( nthreads );
+            pool.push( boost::bind( &IcDirectoryScan::scan_directory, this, &pool, dirpath, true ) );
+            pool.wait();
+        }
+        else
+        {
+            scan_directory( NULL, dirpath, true );
+        }
+        sort( files.begin(), files.end(), natural_less );
+        return files;
+    }
+
+    void print_stats( ostream& os ) const
+    {
+        os << "Directory scan: " << files.size() << " files in " << ndirs << " directories, "
+           << nrestored << " restored from indexes, " << nstat << " entries stat()ed." << endl;
+        if( nunwritable > 0 )
+        {
+            os << nunwritable << " index files could not be written, e.g., " << unwritable_path << endl;
+        }
+    }
+
+    /**
+    * The index file of a directory. A bare file name is put in every
+    * directory, and a path is used only for the top directory.
+    */
+    static string index_path( const string& index, const string& dirpath, bool top = true )
+    {
+        if( index.empty() ) return index;
+        if( index.find_first_of( "/\\" ) != string::npos ) return top ? index : string();
+        return ( boost::filesystem::path( dirpath ) / index ).native_file_string();
+    }
+
+private:
+    static bool natural_less( const filesystem::file_entry& a, const filesystem::file_entry& b )
+    {
+        return filesystem::natural_less( a.path, b.path );
+    }
+
+    void scan_directory( IcThreadPool* pool, const string& dirpath, bool top )
+    {
+        IcFileIndex listing( dirpath, extensions, index_path( index, dirpath, top ), recursive );
+        {
+            boost::mutex::scoped_lock lock( mutex );
+            files.insert( files.end(), listing.filelist().begin(), listing.filelist().end() );
+            ndirs++;
+            nrestored += listing.up_to_date() ? 1 : 0;
+            nstat += listing.stat_count();
+            if( listing.unwritable_index() && nunwritable++ == 0 )
+            {
+                unwritable_path = index_path( index, dirpath, top );
+            }
+        }
+        for( size_t i = 0; i < listing.dirlist().size(); i++ )
+        {
+            pool->push( boost::bind( &IcDirectoryScan::scan_directory, this, pool, listing.dirlist()[i], false ) );
+        }
+    }
+
+    vector<string> extensions;
+    string index;
+    bool recursive;
+    int nthreads;
+    boost::mutex mutex;     /**< guards the results below */
+    vector<filesystem::file_entry> files;
+    int ndirs;              /**< directories scanned */
+    int nrestored;          /**< directories restored from their indexes */
+    int nstat;              /**< entries stat()ed */
+    int nunwritable;        /**< index files not written */
+    string unwritable_path; /**< the first of them */
+};
+
+#endif
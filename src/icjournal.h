@@ -0,0 +1,403 @@
+/** @file
+*
+* Image clipper append only journal of clipped regions
+*
+* The MIT License
+*
+* Copyright (c) 2008, Naotoshi Seo <sonots(at)umd.edu>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#ifndef IC_JOURNAL_INCLUDED
+#define IC_JOURNAL_INCLUDED
+
+#include "cxcore.h"
+#include <stdio.h>
+#include <string.h>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/thread.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include "filesystem.h"
+#include "icsave.h"
+using namespace std;
+
+/**
+* A clipped region, a fixed width record of the journal (48 bytes)
+*/
+typedef struct IcJournalRecord {
+    boost::int64_t time;        /**< milliseconds since 1970-01-01 UTC */
+    boost::uint32_t source;     /**< name id of the source image or video */
+    boost::uint32_t output;     /**< name id of the clipped image */
+    boost::int32_t frame;       /**< frame of a video, 0 for an image */
+    boost::int32_t x;
+    boost::int32_t y;
+    boost::int32_t width;
+    boost::int32_t height;
+    boost::int32_t rotation;    /**< degree */
+    boost::int32_t shear_x;
+    boost::int32_t shear_y;
+} IcJournalRecord;
+
+/**
+* An append only journal of clipped regions
+*
+* The journal is a 64 byte header followed by IcJournalRecords, in host
+* byte order, mapped into memory and grown by chunks. A record is written
+* before the record count in the header is incremented, so the journal
+* stays consistent if imageclipper crashes at any point; the kernel
+* writes the mapped pages back. Records are not msync()ed one by one:
+* an asynchronous flush is started every FLUSH records, and the journal
+* is flushed synchronously when it grows or is closed, so only records of
+* the last moments may be lost if the system itself goes down.
+* Paths are numbered in a companion text
+* file, <journal>.names, one per line, which is appended (and flushed)
+* before a record refers to a new path.
+*
+* All records are loaded by a single sequential read with load().
+*/
+class IcJournal {
+public:
+    /**
+    * Open a journal, creating it if it does not exist
+    *
+    * @param path  The journal file
+    */
+    explicit IcJournal( const string& path )
+        : path( path ), names_fp( NULL ), names_bytes( 0 ), file( NULL ), region( NULL ), header( NULL ),
+          capacity( 0 ), flushed( 0 )
+    {
+        if( !filesystem::exists( path ) && !create() ) return;
+        bool named = load_names( path, names );
+        if( !map() )
+        {
+            close();
+            return;
+        }
+        // name ids would restart at 0 and collide with those recorded
+        if( !named && header->count > 0 )
+        {
+            cerr << "The journal " << path << " has records but " << names_path( path ) << " is missing." << endl;
+            close();
+            return;
+        }
+        for( size_t i = 0; i < names.size(); i++ ) ids[names[i]] = (boost::uint32_t)i;
+        names_fp = fopen( names_path( path ).c_str(), "ab" );
+        if( names_fp == NULL ) close();
+        names_bytes = filesystem::filesize( names_path( path ) );
+        flushed = size();
+    }
+
+    ~IcJournal()
+    {
+        if( region != NULL ) region->flush( 0, 0, false );
+        close();
+    }
+
+    bool opened() const
+    {
+        return header != NULL;
+    }
+
+    /** @return the number of records */
+    size_t size() const
+    {
+        return header != NULL ? (size_t)header->count : 0;
+    }
+
+    /**
+    * Append a record. Thread safe.
+    *
+    * @param source     The source image or video
+    * @param output     The clipped image
+    * @param frame      The frame of a video, 0 for an image
+    * @param rect       The region
+    * @param rotation   The rotation in degree
+    * @param shear      The shear deformation
+    * @return false if the journal is not writable
+    */
+    bool append( const string& source, const string& output, int frame, CvRect rect, int rotation, CvPoint shear )
+    {
+        boost::mutex::scoped_lock lock( mutex );
+        if( header == NULL ) return false;
+        IcJournalRecord record;
+        record.time = now();
+        if( !id( source, record.source ) || !id( output, record.output ) ) return false;
+        record.frame = frame;
+        record.x = rect.x;
+        record.y = rect.y;
+        record.width = rect.width;
+        record.height = rect.height;
+        record.rotation = rotation;
+        record.shear_x = shear.x;
+        record.shear_y = shear.y;
+        if( header->count >= capacity && !grow() ) return false;
+        IcJournalRecord* records = (IcJournalRecord*)( (char*)header + sizeof( Header ) );
+        memcpy( &records[header->count], &record, sizeof( record ) );
+        header->count++; // publish after the record
+        if( header->count - flushed >= FLUSH )
+        {
+            // asynchronously, the records since the last flush and the header
+            size_t begin = sizeof( Header ) + flushed * sizeof( IcJournalRecord );
+            region->flush( begin, (size_t)( header->count - flushed ) * sizeof( IcJournalRecord ), true );
+            region->flush( 0, sizeof( Header ), true );
+            flushed = (size_t)header->count;
+        }
+        return true;
+    }
+
+    /**
+    * Read all records of a journal
+    *
+    * @param path     The journal file
+    * @param records  The records
+    * @param names    The paths indexed by name ids
+    * @return false if path is not a journal, or its names are missing
+    */
+    static bool load( const string& path, vector<IcJournalRecord>& records, vector<string>& names )
+    {
+        FILE* fp = fopen( path.c_str(), "rb" );
+        if( fp == NULL ) return false;
+        Header h;
+        bool ok = fread( &h, sizeof( h ), 1, fp ) == 1 && valid( h );
+        if( ok )
+        {
+            records.resize( (size_t)h.count );
+            ok = records.empty() || fread( &records[0], sizeof( IcJournalRecord ), records.size(), fp ) == records.size();
+        }
+        fclose( fp );
+        return ok && ( load_names( path, names ) || records.empty() );
+    }
+
+    /**
+    * Write a journal as text, one record per line:
+    * time source frame x y width height rotation shear_x shear_y output
+    *
+    * @return false if path is not a journal
+    */
+    static bool dump( const string& path, ostream& os )
+    {
+        vector<IcJournalRecord> records;
+        vector<string> names;
+        if( !load( path, records, names ) ) return false;
+        for( size_t i = 0; i < records.size(); i++ )
+        {
+            const IcJournalRecord& r = records[i];
+            os << r.time << " " << name( names, r.source ) << " " << r.frame << " "
+               << r.x << " " << r.y << " " << r.width << " " << r.height << " "
+               << r.rotation << " " << r.shear_x << " " << r.shear_y << " "
+               << name( names, r.output ) << "\n";
+        }
+        os.flush();
+        return true;
+    }
+
+private:
+    typedef struct Header {
+        char magic[8];                  /**< "ICJRNL1" */
+        boost::uint32_t record_size;    /**< sizeof( IcJournalRecord ) */
+        boost::uint32_t reserved;
+        boost::uint64_t count;          /**< records written */
+        char padding[40];
+    } Header;
+
+    enum { CHUNK = 4096 };  /**< records the file grows by */
+    enum { FLUSH = 64 };    /**< records written between asynchronous flushes */
+
+    static bool valid( const Header& h )
+    {
+        return memcmp( h.magic, "ICJRNL1", 8 ) == 0 && h.record_size == sizeof( IcJournalRecord );
+    }
+
+    static string names_path( const string& path )
+    {
+        return path + ".names";
+    }
+
+    static const string& name( const vector<string>& names, boost::uint32_t id )
+    {
+        static const string unknown = "?";
+        return id < names.size() ? names[id] : unknown;
+    }
+
+    /** @return false if the names file is missing */
+    static bool load_names( const string& path, vector<string>& names )
+    {
+        names.clear();
+        ifstream ifs( names_path( path ).c_str(), ios::binary );
+        if( !ifs ) return false;
+        string line;
+        while( getline( ifs, line ) ) names.push_back( line );
+        return true;
+    }
+
+    static boost::int64_t now()
+    {
+        static const boost::posix_time::ptime epoch( boost::gregorian::date( 1970, 1, 1 ) );
+        return ( boost::posix_time::microsec_clock::universal_time() - epoch ).total_milliseconds();
+    }
+
+    /**
+    * The name id of a path, numbering a new one
+    *
+    * @return false if a new name could not be written
+    */
+    bool id( const string& name, boost::uint32_t& id )
+    {
+        boost::unordered_map<string, boost::uint32_t>::iterator it = ids.find( name );
+        if( it != ids.end() )
+        {
+            id = it->second;
+            return true;
+        }
+        if( fprintf( names_fp, "%s\n", name.c_str() ) < 0 || fflush( names_fp ) != 0 )
+        {
+            cerr << "Failed to write " << names_path( path ) << endl;
+            // a part of the line left would shift the ids of all names after it
+            if( !cut_names() ) close();
+            return false;
+        }
+        names_bytes += name.size() + 1;
+        id = (boost::uint32_t)names.size();
+        names.push_back( name );
+        ids[name] = id;
+        return true;
+    }
+
+    /** Cut the names file back to the names written, reopening it */
+    bool cut_names()
+    {
+        fclose( names_fp ); // drops what could not be flushed
+        names_fp = NULL;
+        FILE* fp = fopen( names_path( path ).c_str(), "r+b" );
+        if( fp == NULL ) return false;
+        bool ok = icTruncateFile( fp, (boost::int64_t)names_bytes );
+        ok = ( fclose( fp ) == 0 ) && ok;
+        if( ok ) names_fp = fopen( names_path( path ).c_str(), "ab" );
+        return names_fp != NULL;
+    }
+
+    bool create()
+    {
+        FILE* fp = fopen( path.c_str(), "wb" );
+        if( fp == NULL )
+        {
+            cerr << "Failed to create the journal " << path << endl;
+            return false;
+        }
+        Header h;
+        memset( &h, 0, sizeof( h ) );
+        memcpy( h.magic, "ICJRNL1", 8 );
+        h.record_size = sizeof( IcJournalRecord );
+        bool ok = fwrite( &h, sizeof( h ), 1, fp ) == 1;
+        ok = ( fclose( fp ) == 0 ) && ok;
+        fp = fopen( names_path( path ).c_str(), "wb" );
+        if( fp == NULL ) return false;
+        return ( fclose( fp ) == 0 ) && ok;
+    }
+
+    /**
+    * Map the whole file, extending it to a multiple of CHUNK records only
+    * if it is not yet, or min_records do not fit
+    */
+    bool map( size_t min_records = 0 )
+    {
+        size_t filesize = filesystem::filesize( path );
+        size_t records = filesize > sizeof( Header ) ? ( filesize - sizeof( Header ) ) / sizeof( IcJournalRecord ) : 0;
+        records = max( records, min_records );
+        records = max( (size_t)CHUNK, ( records + CHUNK - 1 ) / CHUNK * CHUNK );
+        size_t bytes = sizeof( Header ) + records * sizeof( IcJournalRecord );
+        if( bytes > filesize && !extend( bytes ) ) return false;
+        try
+        {
+            file = new boost::interprocess::file_mapping( path.c_str(), boost::interprocess::read_write );
+            region = new boost::interprocess::mapped_region( *file, boost::interprocess::read_write, 0, bytes );
+        }
+        catch( const boost::interprocess::interprocess_exception& e )
+        {
+            cerr << "Failed to map the journal " << path << ": " << e.what() << endl;
+            return false;
+        }
+        Header* h = (Header*)region->get_address();
+        if( !valid( *h ) || h->count > records )
+        {
+            cerr << "The file " << path << " is not a journal." << endl;
+            return false;
+        }
+        header = h;
+        capacity = records;
+        return true;
+    }
+
+    bool grow()
+    {
+        size_t count = (size_t)header->count;
+        region->flush( 0, 0, false );
+        flushed = count;
+        unmap();
+        if( map( count + 1 ) ) return true;
+        close();
+        return false;
+    }
+
+    bool extend( size_t bytes )
+    {
+        FILE* fp = fopen( path.c_str(), "r+b" );
+        if( fp == NULL ) return false;
+        bool ok = icSeekFile( fp, (boost::int64_t)bytes - 1 ) && fputc( 0, fp ) != EOF;
+        return ( fclose( fp ) == 0 ) && ok;
+    }
+
+    void unmap()
+    {
+        delete region;
+        delete file;
+        region = NULL;
+        file = NULL;
+        header = NULL;
+    }
+
+    void close()
+    {
+        unmap();
+        if( names_fp != NULL ) fclose( names_fp );
+        names_fp = NULL;
+    }
+
+    string path;
+    FILE* names_fp;
+    size_t names_bytes;     /**< bytes of the names written */
+    vector<string> names;                               /**< paths by name id */
+    boost::unordered_map<string, boost::uint32_t> ids;  /**< name ids by path */
+    boost::interprocess::file_mapping* file;
+    boost::interprocess::mapped_region* region;
+    Header* header;         /**< the beginning of the mapped file */
+    size_t capacity;        /**< records the mapped file can hold */
+    size_t flushed;         /**< records flushed */
+    boost::mutex mutex;     /**< guards all above in append() */
+};
+
+#endif
@@ -0,0 +1,184 @@
+/** @file
+*
+* Image clipper background image prefetcher
+*
+* The MIT License
+*
+* Copyright (c) 2008, Naotoshi Seo <sonots(at)umd.edu>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#ifndef IC_PREFETCH_INCLUDED
+#define IC_PREFETCH_INCLUDED
+
+#include "cv.h"
+#include "cxcore.h"
+#include "highgui.h"
+#include <string>
+#include <vector>
+#include <set>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include "filesystem.h"
+#include "iccache.h"
+#include "ictiled.h"
+using namespace std;
+
+/**
+* Decode images around the cursor of a file list in a background thread
+*
+* Images in [cursor - radius, cursor + radius] are decoded into the
+* image cache, nearer ones first and forward before backward. Images
+* returned by get() are owned by the cache; do not release them. Nothing
+* is decoded before the cursor is first placed by move() or get().
+* Images to be memory mapped (see IcTiledImage) are never decoded.
+*/
+class IcPrefetcher {
+public:
+    /**
+    * @param filelist      The file list. Must outlive the prefetcher.
+    * @param cache         The image cache. Must outlive the prefetcher.
+    * @param [radius = 2]  The number of images to decode ahead and behind
+    * @param [tiled_bytes = 0]
+    *                      Skip images IcTiledImage maps for this threshold.
+    *                      0 not to skip.
+    */
+    IcPrefetcher( const vector<filesystem::file_entry>& filelist, IcImageCache* cache, int radius = 2,
+                  size_t tiled_bytes = 0 )
+        : filelist( filelist ), cache( cache ), radius( max( 0, radius ) ), tiled_bytes( tiled_bytes ),
+          cursor( -1 ), loading( -1 ), stopping( false )
+    {
+        thread = boost::thread( boost::bind( &IcPrefetcher::run, this ) );
+    }
+
+    ~IcPrefetcher()
+    {
+        {
+            boost::mutex::scoped_lock lock( mutex );
+            stopping = true;
+        }
+        moved.notify_all();
+        thread.join();
+    }
+
+    /**
+    * Move the cursor and get the decoded image there
+    *
+    * @param index  The index of the file list
+    * @return The image, or NULL if not loadable
+    */
+    IplImage* get( int index )
+    {
+        {
+            boost::mutex::scoped_lock lock( mutex );
+            move_locked( index );
+            while( loading == index ) loaded.wait( lock );
+        }
+
+        IplImage* img;
+        if( cache->acquire( filelist[index].path, img ) ) return img;
+        // not prefetched yet. load by myself.
+        img = cvLoadImage( filelist[index].path.c_str() );
+        return cache->insert( filelist[index].path, img, true );
+    }
+
+    /**
+    * Move the cursor without getting the image
+    */
+    void move( int index )
+    {
+        boost::mutex::scoped_lock lock( mutex );
+        move_locked( index );
+    }
+
+private:
+    void move_locked( int index )
+    {
+        cursor = index;
+        visited.clear();
+        moved.notify_all();
+    }
+
+    /** @return The nearest index to be loaded, or -1 */
+    int next_index()
+    {
+        if( cursor < 0 ) return -1; // not moved yet, e.g., to the image resumed
+        for( int d = 1; d <= radius; d++ )
+        {
+            int candidates[] = { cursor + d, cursor - d };
+            for( int i = 0; i < 2; i++ )
+            {
+                int index = candidates[i];
+                if( index < 0 || index >= (int)filelist.size() ) continue;
+                if( visited.count( index ) ) continue;
+                visited.insert( index );
+                if( tiled.count( index ) ) continue;
+                if( !cache->contains( filelist[index].path ) ) return index;
+            }
+        }
+        return -1;
+    }
+
+    void run()
+    {
+        boost::mutex::scoped_lock lock( mutex );
+        while( !stopping )
+        {
+            int index = next_index();
+            if( index < 0 )
+            {
+                moved.wait( lock );
+                continue;
+            }
+            loading = index;
+            lock.unlock();
+            // classified out of the lock, which get() takes on the UI thread
+            if( tiled_bytes > 0 && IcTiledImage::is_tiled( filelist[index].path, tiled_bytes ) )
+            {
+                lock.lock();
+                tiled.insert( index );
+            }
+            else
+            {
+                IplImage* img = cvLoadImage( filelist[index].path.c_str() );
+                cache->insert( filelist[index].path, img );
+                lock.lock();
+            }
+            loading = -1;
+            loaded.notify_all();
+        }
+    }
+
+    const vector<filesystem::file_entry>& filelist;
+    IcImageCache* cache;
+    int radius;
+    size_t tiled_bytes;
+    int cursor;                      /**< index shown now, -1 until the first move() or get() */
+    int loading;                     /**< index being decoded by the thread */
+    bool stopping;
+    set<int> visited;                /**< indices checked since the cursor moved */
+    set<int> tiled;                  /**< indices of images to be memory mapped */
+    boost::mutex mutex;
+    boost::condition_variable moved; /**< cursor moved or stopping */
+    boost::condition_variable loaded;
+    boost::thread thread;
+};
+
+#endif
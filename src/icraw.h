@@ -0,0 +1,317 @@
+/** @file
+*
+* Image clipper raw tensor file of clipped images
+*
+* The MIT License
+*
+* Copyright (c) 2008, Naotoshi Seo <sonots(at)umd.edu>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+
+#ifndef IC_RAW_INCLUDED
+#define IC_RAW_INCLUDED
+
+#include "cv.h"
+#include "cxcore.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <boost/cstdint.hpp>
+#include <boost/thread.hpp>
+#include "filesystem.h"
+#include "icsave.h"
+using namespace std;
+
+/**
+* The header of a raw tensor file (64 bytes)
+*/
+typedef struct IcRawHeader {
+    char magic[8];                  /**< "ICRAW1" */
+    boost::uint32_t header_size;    /**< bytes before the first image */
+    boost::uint32_t height;
+    boost::uint32_t width;
+    boost::uint32_t channels;
+    char order[8];                  /**< channel order, "RGB" */
+    boost::uint64_t count;          /**< number of images */
+    char reserved[24];
+} IcRawHeader;
+
+/**
+* Clipped images resized to a fixed size and appended to a raw tensor file
+*
+* The file is an IcRawHeader followed by count images of height x width x
+* channels uint8, rows top to bottom and channels interleaved in RGB order
+* (NHWC), in host byte order, so a data loader maps it as one array without
+* decoding. The directory of an output path selects the file and its
+* filename is appended to a companion text file, one per line in the same
+* order, e.g., an image saved as /data/imageclipper/a_0001.png goes to
+* /data/imageclipper.raw and a_0001.png to /data/imageclipper.raw.names.
+*
+* An image is written before the count in the header is incremented, so
+* the file stays consistent if imageclipper crashes, and an existing file
+* of the same shape is appended to.
+*/
+class IcRawSink : public IcImageSink {
+public:
+    /**
+    * @param size  The size images are resized to
+    */
+    explicit IcRawSink( CvSize size ) : size( size ) {}
+
+    ~IcRawSink()
+    {
+        sync();
+        for( map<string, RawFile>::iterator it = files.begin(); it != files.end(); ++it )
+        {
+            if( it->second.fp != NULL ) fclose( it->second.fp );
+            if( it->second.names_fp != NULL ) fclose( it->second.names_fp );
+        }
+    }
+
+    bool sync()
+    {
+        boost::mutex::scoped_lock lock( mutex );
+        bool ok = true;
+        for( map<string, RawFile>::iterator it = files.begin(); it != files.end(); ++it )
+        {
+            if( it->second.fp != NULL ) ok = icSyncFile( it->second.fp ) && ok;
+            if( it->second.names_fp != NULL ) ok = icSyncFile( it->second.names_fp ) && ok;
+        }
+        return ok;
+    }
+
+    bool write( const string& path, const IplImage* img )
+    {
+        string prefix = filesystem::dirname( path );
+        if( prefix.empty() ) prefix = "imageclipper";
+        string name = filesystem::basename( path );
+        vector<uchar> data;
+        if( !pack( img, data ) )
+        {
+            cerr << "Only 8-bit gray, BGR, or BGRA images are written to raw tensor files." << endl;
+            return false;
+        }
+
+        boost::mutex::scoped_lock lock( mutex );
+        RawFile& file = files[prefix];
+        if( file.fp == NULL && ( file.failed || !open( prefix + ".raw", file ) ) )
+        {
+            file.failed = true;
+            return false;
+        }
+        boost::int64_t end = (boost::int64_t)sizeof( IcRawHeader ) + (boost::int64_t)file.count * data.size();
+        bool ok = icSeekFile( file.fp, end ) && fwrite( &data[0], 1, data.size(), file.fp ) == data.size() &&
+            fflush( file.fp ) == 0;
+        ok = ok && fprintf( file.names_fp, "%s\n", name.c_str() ) > 0 && fflush( file.names_fp ) == 0;
+        if( !ok ) return false;
+        // the image is counted only after it is written
+        boost::uint64_t count = file.count + 1;
+        ok = icSeekFile( file.fp, offsetof( IcRawHeader, count ) ) &&
+            fwrite( &count, sizeof( count ), 1, file.fp ) == 1 && fflush( file.fp ) == 0;
+        if( ok ) file.count = count;
+        return ok;
+    }
+
+private:
+    struct RawFile {
+        FILE* fp;
+        FILE* names_fp;
+        boost::uint64_t count;
+        bool failed;        /**< not writable, reported once */
+        RawFile() : fp( NULL ), names_fp( NULL ), count( 0 ), failed( false ) {}
+    };
+
+    /**
+    * Resize an image, convert it to RGB, and pack its rows
+    *
+    * @return false if the image is not 8-bit gray, BGR, or BGRA
+    */
+    bool pack( const IplImage* img, vector<uchar>& data ) const
+    {
+        if( img->depth != IPL_DEPTH_8U ) return false;
+        int code;
+        switch( img->nChannels )
+        {
+        case 1: code = CV_GRAY2RGB; break;
+        case 3: code = CV_BGR2RGB; break;
+        case 4: code = CV_BGRA2RGB; break;
+        default: return false;
+        }
+        IplImage* resized = cvCreateImage( size, IPL_DEPTH_8U, img->nChannels );
+        cvResize( img, resized, CV_INTER_AREA );
+        IplImage* rgb = cvCreateImage( size, IPL_DEPTH_8U, 3 );
+        cvCvtColor( resized, rgb, code );
+        size_t rowbytes = (size_t)size.width * 3;
+        data.resize( rowbytes * size.height );
+        for( int y = 0; y < size.height; y++ )
+        {
+            memcpy( &data[rowbytes * y], rgb->imageData + rgb->widthStep * y, rowbytes );
+        }
+        cvReleaseImage( &rgb );
+        cvReleaseImage( &resized );
+        return true;
+    }
+
+    /** The header of a file of no images for the size */
+    IcRawHeader make_header() const
+    {
+        IcRawHeader header;
+        memset( &header, 0, sizeof( header ) );
+        memcpy( header.magic, "ICRAW1", 6 );
+        header.header_size = sizeof( header );
+        header.height = size.height;
+        header.width = size.width;
+        header.channels = 3;
+        memcpy( header.order, "RGB", 3 );
+        return header;
+    }
+
+    /**
+    * Check every field of the header of an existing file except the count
+    * against the header this sink writes, and that the file holds count
+    * images
+    */
+    bool check_header( const string& path, const IcRawHeader& header ) const
+    {
+        IcRawHeader expected = make_header();
+        if( memcmp( header.magic, expected.magic, sizeof( header.magic ) ) != 0 ||
+            header.header_size != expected.header_size )
+        {
+            cerr << "The file " << path << " is not a raw tensor file of imageclipper." << endl;
+            return false;
+        }
+        if( header.width != expected.width || header.height != expected.height )
+        {
+            cerr << "The file " << path << " holds " << header.width << "x" << header.height
+                 << " images, not " << size.width << "x" << size.height << "." << endl;
+            return false;
+        }
+        if( header.channels != expected.channels ||
+            memcmp( header.order, expected.order, sizeof( header.order ) ) != 0 )
+        {
+            cerr << "The file " << path << " holds images of " << header.channels << " channels in "
+                 << string( header.order, strnlen( header.order, sizeof( header.order ) ) )
+                 << " order, not 3 channels in RGB order." << endl;
+            return false;
+        }
+        if( memcmp( header.reserved, expected.reserved, sizeof( header.reserved ) ) != 0 )
+        {
+            cerr << "The file " << path << " is of a newer version of imageclipper." << endl;
+            return false;
+        }
+        boost::uint64_t bytes = (boost::uint64_t)size.width * size.height * 3;
+        boost::uint64_t filesize = boost::filesystem::file_size( boost::filesystem::path( path ) );
+        if( filesize < sizeof( header ) + header.count * bytes )
+        {
+            cerr << "The file " << path << " is shorter than its " << header.count << " images." << endl;
+            return false;
+        }
+        return true;
+    }
+
+    /** Open a raw file, creating it if it does not exist */
+    bool open( const string& path, RawFile& file )
+    {
+        IcRawHeader header;
+        string names_path = path + ".names";
+        if( !filesystem::exists( path ) )
+        {
+            string dirname = filesystem::dirname( path );
+            if( !dirname.empty() ) filesystem::r_mkdir( dirname );
+            header = make_header();
+            file.fp = fopen( path.c_str(), "w+b" );
+            if( file.fp == NULL || fwrite( &header, sizeof( header ), 1, file.fp ) != 1 || fflush( file.fp ) != 0 )
+            {
+                cerr << "Failed to create " << path << endl;
+                return close( file );
+            }
+            file.names_fp = fopen( names_path.c_str(), "wb" );
+        }
+        else
+        {
+            file.fp = fopen( path.c_str(), "r+b" );
+            if( file.fp == NULL || fread( &header, sizeof( header ), 1, file.fp ) != 1 )
+            {
+                cerr << "The file " << path << " is not a raw tensor file of imageclipper." << endl;
+                return close( file );
+            }
+            if( !check_header( path, header ) ) return close( file );
+            if( !truncate_names( names_path, header.count ) )
+            {
+                cerr << "The file " << names_path << " does not name all images of " << path << endl;
+                return close( file );
+            }
+            file.names_fp = fopen( names_path.c_str(), "ab" );
+        }
+        if( file.names_fp == NULL )
+        {
+            cerr << "Failed to open " << names_path << endl;
+            return close( file );
+        }
+        file.count = header.count;
+        cerr << "Now writing " << path << " from image " << file.count << endl;
+        return true;
+    }
+
+    /** @return false always */
+    static bool close( RawFile& file )
+    {
+        if( file.fp != NULL ) fclose( file.fp );
+        file.fp = NULL;
+        return false;
+    }
+
+    /**
+    * Drop names beyond the count, left by a crash before their images
+    * were counted. The file is cut in place, so that a crash meanwhile
+    * cannot lose the names kept.
+    *
+    * @return false if fewer names than count
+    */
+    static bool truncate_names( const string& path, boost::uint64_t count )
+    {
+        ifstream is( path.c_str(), ios::in | ios::binary );
+        boost::int64_t bytes = 0;
+        string line;
+        for( boost::uint64_t i = 0; i < count; i++ )
+        {
+            // a name counted ends with a newline
+            if( !getline( is, line ) || is.eof() ) return false;
+            bytes += (boost::int64_t)line.size() + 1;
+        }
+        is.close();
+        FILE* fp = fopen( path.c_str(), "r+b" );
+        if( fp == NULL ) return count == 0;
+        bool ok = icTruncateFile( fp, bytes );
+        return ( fclose( fp ) == 0 ) && ok;
+    }
+
+    CvSize size;
+    map<string, RawFile> files;     /**< by prefix */
+    boost::mutex mutex;
+};
+
+#endif
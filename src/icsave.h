@@ -0,0 +1,282 @@
+/** @file
+*
+* Image clipper background image writer
+*
+* The MIT License
+*
+* Copyright (c) 2008, Naotoshi Seo <sonots(at)umd.edu>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#ifndef IC_SAVE_INCLUDED
+#define IC_SAVE_INCLUDED
+
+#include "cv.h"
+#include "cxcore.h"
+#include "highgui.h"
+#include <stdio.h>
+#include <iostream>
+#include <string>
+#include <deque>
+#include <set>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/cstdint.hpp>
+#include "filesystem.h"
+#if defined(WIN32) || defined(WIN64)
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+using namespace std;
+
+/**
+* Write back what was written to a stream to the disk
+*
+* @param fp  The stream
+* @return false if it could not be written back
+*/
+inline bool icSyncFile( FILE* fp )
+{
+    if( fflush( fp ) != 0 ) return false;
+#if defined(WIN32) || defined(WIN64)
+    return _commit( _fileno( fp ) ) == 0;
+#else
+    return fsync( fileno( fp ) ) == 0;
+#endif
+}
+
+/**
+* Write back a closed file to the disk
+*
+* @param path  The filename
+* @return false if it could not be written back
+*/
+inline bool icSyncPath( const string& path )
+{
+#if defined(WIN32) || defined(WIN64)
+    int fd = _open( path.c_str(), _O_RDWR | _O_BINARY );
+    if( fd < 0 ) return false;
+    bool ok = _commit( fd ) == 0;
+    _close( fd );
+#else
+    int fd = open( path.c_str(), O_RDONLY );
+    if( fd < 0 ) return false;
+    bool ok = fsync( fd ) == 0;
+    close( fd );
+#endif
+    return ok;
+}
+
+/**
+* Seek a stream beyond 2GB
+*
+* @param fp      The stream
+* @param offset  Bytes from the beginning
+* @return false if it could not seek
+*/
+inline bool icSeekFile( FILE* fp, boost::int64_t offset )
+{
+#ifdef _MSC_VER
+    return _fseeki64( fp, offset, SEEK_SET ) == 0;
+#else
+    return fseeko( fp, (off_t)offset, SEEK_SET ) == 0;
+#endif
+}
+
+/**
+* Cut a file opened by a stream to a size, and seek to the new end
+*
+* @param fp    The stream
+* @param size  Bytes to be kept
+* @return false if it could not be cut
+*/
+inline bool icTruncateFile( FILE* fp, boost::int64_t size )
+{
+    if( fflush( fp ) != 0 ) return false;
+#ifdef _MSC_VER
+    if( _chsize_s( _fileno( fp ), size ) != 0 ) return false;
+#else
+    if( ftruncate( fileno( fp ), (off_t)size ) != 0 ) return false;
+#endif
+    return icSeekFile( fp, size );
+}
+
+/**
+* A destination of clipped images other than one file per image, e.g.,
+* shards of a tar archive. write() must be thread safe.
+*/
+class IcImageSink {
+public:
+    virtual ~IcImageSink() {}
+
+    /**
+    * Write an image
+    *
+    * @param path  The output filename given by the output format
+    * @param img   The image
+    * @return false if it could not be written
+    */
+    virtual bool write( const string& path, const IplImage* img ) = 0;
+
+    /**
+    * Write back the images written so far to the disk
+    *
+    * @return false if they could not be written back
+    */
+    virtual bool sync() = 0;
+};
+
+/**
+* Encode and write images in a background thread
+*
+* push() returns as soon as the image is queued, and blocks only while
+* depth images are already waiting. Queued images are always written
+* before flush() or the destructor returns. An image is written back to
+* the disk before its completion is called, so whatever a completion
+* records about the image stays true after a crash.
+*/
+class IcSaveQueue {
+public:
+    /**
+    * @param [depth = 8]    The maximum number of images waiting to be written
+    * @param [sink = NULL]  Images are written to this instead of files if given
+    */
+    explicit IcSaveQueue( int depth = 8, IcImageSink* sink = NULL )
+        : depth( max( 1, depth ) ), sink( sink ), writing( false ), stopping( false )
+    {
+        thread = boost::thread( boost::bind( &IcSaveQueue::run, this ) );
+    }
+
+    ~IcSaveQueue()
+    {
+        flush();
+        {
+            boost::mutex::scoped_lock lock( mutex );
+            stopping = true;
+        }
+        queued.notify_all();
+        thread.join();
+    }
+
+    /**
+    * Queue an image to be written. The queue takes the ownership.
+    *
+    * The directory of the path is created if it does not exist.
+    *
+    * @param path        The output filename
+    * @param img         The image
+    * @param [complete]  Called by the writer thread once the image is written
+    */
+    void push( const string& path, IplImage* img,
+               boost::function<void ()> complete = boost::function<void ()>() )
+    {
+        boost::mutex::scoped_lock lock( mutex );
+        while( (int)jobs.size() >= depth ) dequeued.wait( lock );
+        Job job = { path, img, complete };
+        jobs.push_back( job );
+        queued.notify_one();
+    }
+
+    /**
+    * Block until all queued images are written
+    */
+    void flush()
+    {
+        boost::mutex::scoped_lock lock( mutex );
+        while( !jobs.empty() || writing ) dequeued.wait( lock );
+    }
+
+private:
+    struct Job {
+        string path;
+        IplImage* img;
+        boost::function<void ()> complete;
+    };
+
+    void run()
+    {
+        boost::mutex::scoped_lock lock( mutex );
+        while( true )
+        {
+            while( jobs.empty() && !stopping ) queued.wait( lock );
+            if( jobs.empty() ) return;
+            Job job = jobs.front();
+            jobs.pop_front();
+            writing = true;
+            lock.unlock();
+
+            bool saved;
+            if( job.img == NULL )
+            {
+                saved = false;
+            }
+            else if( sink != NULL )
+            {
+                saved = sink->write( job.path, job.img ) && sink->sync();
+            }
+            else
+            {
+                string dirname = filesystem::dirname( job.path );
+                if( made_dirs.insert( dirname ).second )
+                {
+                    filesystem::r_mkdir( dirname );
+                }
+                saved = cvSaveImage( job.path.c_str(), job.img ) != 0;
+                if( !saved )
+                {
+                    // the directory may have been removed since it was made
+                    filesystem::r_mkdir( dirname );
+                    saved = cvSaveImage( job.path.c_str(), job.img ) != 0;
+                }
+                saved = saved && icSyncPath( job.path );
+            }
+            if( !saved )
+            {
+                cerr << "Failed to write " << job.path << endl;
+            }
+            else if( job.complete )
+            {
+                job.complete();
+            }
+            if( job.img != NULL ) cvReleaseImage( &job.img );
+
+            lock.lock();
+            writing = false;
+            dequeued.notify_all();
+        }
+    }
+
+    int depth;
+    IcImageSink* sink;
+    bool writing;                       /**< a job is being written */
+    bool stopping;
+    deque<Job> jobs;
+    set<string> made_dirs;              /**< touched by the writer thread only */
+    boost::mutex mutex;
+    boost::condition_variable queued;   /**< a job is queued or stopping */
+    boost::condition_variable dequeued; /**< a job is taken or written */
+    boost::thread thread;
+};
+
+#endif
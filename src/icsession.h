@@ -0,0 +1,141 @@
+/** @file
+*
+* Image clipper session to resume where it was quit
+*
+* The MIT License
+*
+* Copyright (c) 2008, Naotoshi Seo <sonots(at)umd.edu>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+
+#ifndef IC_SESSION_INCLUDED
+#define IC_SESSION_INCLUDED
+
+#include "cxcore.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <iostream>
+#include <fstream>
+#include <string>
+using namespace std;
+
+/**
+* The position and the rectangle of an imageclipper session
+*
+* A session is a small text file, one "key value" per line, e.g.,
+* <pre>
+* imageclipper session 1
+* reference /home/user/images
+* file /home/user/images/0123.jpg
+* index 123
+* frame 1
+* rect 10 20 64 48
+* rotate 0
+* shear 0 0
+* </pre>
+* It is rewritten as a whole by save(), through a temporary file renamed
+* over the old one, so a crash leaves either the old or the new session.
+*
+* The index restores the position without stepping through the listing;
+* file confirms it and is searched for instead if the listing changed.
+*/
+class IcSession {
+public:
+    string reference;   /**< canonical path of the directory, image or video */
+    string file;        /**< canonical path of the image shown, empty for a video */
+    int index;          /**< index of file in the listing */
+    int frame;          /**< the frame of a video */
+    CvRect rect;
+    int rotate;
+    CvPoint shear;
+
+    IcSession() : index( 0 ), frame( 1 ), rect( cvRect( 0, 0, 0, 0 ) ), rotate( 0 ), shear( cvPoint( 0, 0 ) ) {}
+
+    /**
+    * Read a session file
+    *
+    * @param path  The session file
+    * @return false if it does not exist or is not a session
+    */
+    bool load( const string& path )
+    {
+        ifstream is( path.c_str(), ios::in | ios::binary );
+        string line;
+        if( !getline( is, line ) || strip( line ) != signature() ) return false;
+        while( getline( is, line ) )
+        {
+            line = strip( line );
+            string::size_type sep = line.find( ' ' );
+            string key = line.substr( 0, sep );
+            string value = sep == string::npos ? "" : line.substr( sep + 1 );
+            const char* v = value.c_str();
+            if( key == "reference" ) reference = value;
+            else if( key == "file" ) file = value;
+            else if( key == "index" ) index = atoi( v );
+            else if( key == "frame" ) frame = atoi( v );
+            else if( key == "rect" ) sscanf( v, "%d %d %d %d", &rect.x, &rect.y, &rect.width, &rect.height );
+            else if( key == "rotate" ) rotate = atoi( v );
+            else if( key == "shear" ) sscanf( v, "%d %d", &shear.x, &shear.y );
+        }
+        return true;
+    }
+
+    /**
+    * Write the session file
+    *
+    * @param path  The session file
+    * @return false if it could not be written
+    */
+    bool save( const string& path ) const
+    {
+        string tmp_path = path + ".tmp";
+        FILE* fp = fopen( tmp_path.c_str(), "wb" );
+        if( fp == NULL ) return false;
+        fprintf( fp, "%s\nreference %s\nfile %s\nindex %d\nframe %d\n", signature(),
+                 reference.c_str(), file.c_str(), index, frame );
+        fprintf( fp, "rect %d %d %d %d\nrotate %d\nshear %d %d\n",
+                 rect.x, rect.y, rect.width, rect.height, rotate, shear.x, shear.y );
+        bool ok = !ferror( fp );
+        ok = ( fclose( fp ) == 0 ) && ok;
+        if( ok && rename( tmp_path.c_str(), path.c_str() ) != 0 )
+        {
+            // rename does not overwrite on Windows
+            remove( path.c_str() );
+            ok = ( rename( tmp_path.c_str(), path.c_str() ) == 0 );
+        }
+        if( !ok ) remove( tmp_path.c_str() );
+        return ok;
+    }
+
+private:
+    static const char* signature()
+    {
+        return "imageclipper session 1";
+    }
+
+    /** Remove a trailing carriage return of a file written on Windows */
+    static string strip( const string& line )
+    {
+        return !line.empty() && line[line.size() - 1] == '\r' ? line.substr( 0, line.size() - 1 ) : line;
+    }
+};
+
+#endif
@@ -0,0 +1,281 @@
+/** @file
+*
+* Image clipper tar shards of clipped images
+*
+* The MIT License
+*
+* Copyright (c) 2008, Naotoshi Seo <sonots(at)umd.edu>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+
+#ifndef IC_SHARD_INCLUDED
+#define IC_SHARD_INCLUDED
+
+#include "cv.h"
+#include "cxcore.h"
+#include "highgui.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <boost/thread.hpp>
+#include "filesystem.h"
+#include "icsave.h"
+using namespace std;
+
+/**
+* Clipped images appended to tar archives rolled over at a size threshold
+*
+* The directory of an output path selects a series of shards, and its
+* filename becomes the member name, e.g., an image saved as
+* /data/imageclipper/a_0001.png is appended to /data/imageclipper-00000.tar
+* (then -00001.tar, ...) as a_0001.png. A series starts after the last
+* existing shard, so shards of former runs are never overwritten.
+*
+* Shards are ustar archives, with pax headers for member names longer
+* than 100 bytes, written sequentially, so any tar reader or a loader
+* streaming 512 byte headers reads them. A shard is terminated when it is
+* rolled over or the sink is destroyed. A member which fails to be
+* written is cut off and its shard is terminated, and a shard cut by a
+* crash is still readable up to its last complete member.
+*/
+class IcTarSink : public IcImageSink {
+public:
+    /**
+    * @param [shard_bytes = 1GB]  A shard is rolled over before it exceeds this.
+    *                             An image larger than this gets a shard alone.
+    */
+    explicit IcTarSink( size_t shard_bytes = 1024 * 1024 * 1024 ) : shard_bytes( shard_bytes ) {}
+
+    ~IcTarSink()
+    {
+        for( map<string, Shard>::iterator it = shards.begin(); it != shards.end(); ++it )
+        {
+            close( it->second );
+        }
+    }
+
+    bool write( const string& path, const IplImage* img )
+    {
+        string prefix = filesystem::dirname( path );
+        if( prefix.empty() ) prefix = "imageclipper";
+        string name = filesystem::basename( path );
+        vector<char> data;
+#if CV_MAJOR_VERSION >= 2
+        if( !encode( filesystem::extension( path ), img, data ) ) return false;
+        boost::mutex::scoped_lock lock( mutex );
+#else
+        // no encoder into memory; a temporary file is reused under the lock
+        boost::mutex::scoped_lock lock( mutex );
+        if( !encode( prefix + "-encoding." + filesystem::extension( path ), img, data ) ) return false;
+#endif
+        Shard& shard = shards[prefix];
+        string pax = pax_record( name );
+        size_t bytes = ( pax.empty() ? 0 : BLOCK + padded( pax.size() ) ) + BLOCK + padded( data.size() );
+        if( shard.fp != NULL && shard.bytes + bytes + 2 * BLOCK > shard_bytes ) close( shard );
+        if( shard.fp == NULL && !open( prefix, shard ) ) return false;
+        bool ok = ( pax.empty() || put( shard.fp, "././@PaxHeader", pax.data(), pax.size(), 'x' ) ) &&
+            put( shard.fp, name, data.empty() ? NULL : &data[0], data.size(), '0' ) && fflush( shard.fp ) == 0;
+        if( !ok )
+        {
+            abandon( shard );
+            return false;
+        }
+        shard.bytes += bytes;
+        return true;
+    }
+
+    bool sync()
+    {
+        boost::mutex::scoped_lock lock( mutex );
+        bool ok = true;
+        for( map<string, Shard>::iterator it = shards.begin(); it != shards.end(); ++it )
+        {
+            if( it->second.fp != NULL ) ok = icSyncFile( it->second.fp ) && ok;
+        }
+        return ok;
+    }
+
+private:
+    enum { BLOCK = 512 };
+
+    struct Shard {
+        FILE* fp;
+        string path;
+        size_t bytes;   /**< bytes written to the shard */
+        int number;     /**< number of the shard in its series */
+        Shard() : fp( NULL ), bytes( 0 ), number( -1 ) {}
+    };
+
+    /** Open the next shard of the series which does not exist yet */
+    bool open( const string& prefix, Shard& shard )
+    {
+        char suffix[32];
+        do
+        {
+            sprintf( suffix, "-%05d.tar", ++shard.number );
+            shard.path = prefix + suffix;
+        } while( filesystem::exists( shard.path ) );
+        make_dirs( shard.path );
+        shard.fp = fopen( shard.path.c_str(), "wb" );
+        shard.bytes = 0;
+        if( shard.fp == NULL )
+        {
+            cerr << "Failed to create " << shard.path << endl;
+            return false;
+        }
+        cerr << "Now writing " << shard.path << endl;
+        return true;
+    }
+
+    /**
+    * Cut a partially written member off a shard and terminate it, so that
+    * the shard stays readable and the next member goes to a new shard
+    */
+    static void abandon( Shard& shard )
+    {
+        // closed first, so that no data left in the buffer follows the cut
+        fclose( shard.fp );
+        shard.fp = fopen( shard.path.c_str(), "r+b" );
+        if( shard.fp == NULL || !icTruncateFile( shard.fp, shard.bytes ) )
+        {
+            cerr << "Failed to cut a partial member off " << shard.path << ". It is readable up to byte "
+                 << shard.bytes << "." << endl;
+            if( shard.fp != NULL ) fclose( shard.fp );
+            shard.fp = NULL;
+            return;
+        }
+        close( shard );
+    }
+
+    /** Terminate a shard by two zero blocks */
+    static void close( Shard& shard )
+    {
+        if( shard.fp == NULL ) return;
+        static const char zeros[2 * BLOCK] = { 0 };
+        bool ok = fwrite( zeros, 1, sizeof( zeros ), shard.fp ) == sizeof( zeros );
+        ok = icSyncFile( shard.fp ) && ok;
+        ok = ( fclose( shard.fp ) == 0 ) && ok;
+        if( !ok )
+        {
+            cerr << "Failed to write " << shard.path << endl;
+        }
+        shard.fp = NULL;
+    }
+
+    void make_dirs( const string& path )
+    {
+        string dirname = filesystem::dirname( path );
+        if( !dirname.empty() && made_dirs.insert( dirname ).second ) filesystem::r_mkdir( dirname );
+    }
+
+#if CV_MAJOR_VERSION >= 2
+    /** Encode an image in the format of an extension */
+    static bool encode( const string& extension, const IplImage* img, vector<char>& data )
+    {
+        CvMat* buf = cvEncodeImage( ( "." + extension ).c_str(), img );
+        if( buf == NULL ) return false;
+        data.assign( buf->data.ptr, buf->data.ptr + buf->rows * buf->cols );
+        cvReleaseMat( &buf );
+        return true;
+    }
+#else
+    /** Encode an image through a temporary file whose extension gives the format */
+    bool encode( const string& tmp_path, const IplImage* img, vector<char>& data )
+    {
+        make_dirs( tmp_path );
+        bool ok = cvSaveImage( tmp_path.c_str(), img ) != 0;
+        FILE* fp = ok ? fopen( tmp_path.c_str(), "rb" ) : NULL;
+        if( fp != NULL )
+        {
+            data.resize( filesystem::filesize( tmp_path ) );
+            ok = data.empty() || fread( &data[0], 1, data.size(), fp ) == data.size();
+            fclose( fp );
+        }
+        remove( tmp_path.c_str() );
+        return ok && fp != NULL;
+    }
+#endif
+
+    static size_t padded( size_t size )
+    {
+        return ( size + BLOCK - 1 ) / BLOCK * BLOCK;
+    }
+
+    /**
+    * A pax extended header record carrying a name too long for ustar,
+    * "<length> path=<name>\n" where length counts the whole record
+    *
+    * @return the record, or empty if the name fits
+    */
+    static string pax_record( const string& name )
+    {
+        if( name.size() <= 100 ) return "";
+        string body = " path=" + name + "\n";
+        size_t length = body.size() + 1;
+        char digits[32];
+        while( true )
+        {
+            int n = sprintf( digits, "%lu", (unsigned long)length );
+            if( body.size() + n == length ) break;
+            length = body.size() + n;
+        }
+        return digits + body;
+    }
+
+    /** Write a member, its header and data padded to blocks */
+    static bool put( FILE* fp, const string& name, const char* data, size_t size, char type )
+    {
+        char header[BLOCK];
+        memset( header, 0, BLOCK );
+        strncpy( header, name.c_str(), 100 ); // the pax record before has the whole name
+        sprintf( header + 100, "%07o", 0644 );
+        sprintf( header + 108, "%07o", 0 );
+        sprintf( header + 116, "%07o", 0 );
+        sprintf( header + 124, "%011lo", (unsigned long)size );
+        sprintf( header + 136, "%011lo", (unsigned long)time( NULL ) );
+        header[156] = type;
+        memcpy( header + 257, "ustar", 6 );
+        memcpy( header + 263, "00", 2 );
+        // the checksum is computed with its own field as spaces
+        memset( header + 148, ' ', 8 );
+        unsigned long checksum = 0;
+        for( int i = 0; i < BLOCK; i++ ) checksum += (unsigned char)header[i];
+        sprintf( header + 148, "%06lo", checksum );
+        header[155] = ' ';
+        static const char zeros[BLOCK] = { 0 };
+        size_t padding = padded( size ) - size;
+        return fwrite( header, 1, BLOCK, fp ) == BLOCK &&
+            ( size == 0 || fwrite( data, 1, size, fp ) == size ) &&
+            fwrite( zeros, 1, padding, fp ) == padding;
+    }
+
+    size_t shard_bytes;
+    map<string, Shard> shards;  /**< series by prefix */
+    set<string> made_dirs;
+    boost::mutex mutex;
+};
+
+#endif
@@ -0,0 +1,722 @@
+/** @file */
+/* The MIT License
+ *
+ * Copyright (c) 2008, Naotoshi Seo <sonots(at)gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+/**
+ * Checks of the parts of imageclipper which need no window
+ *
+ * $ make test
+ *
+ * Files are written under ictest.tmp/ of the current directory.
+ */
+#ifdef _MSC_VER // MS Visual Studio
+#pragma warning(disable:4996)
+#pragma warning(disable:4244) // possible loss of data
+#pragma comment(lib, "cv.lib")
+#pragma comment(lib, "cvaux.lib")
+#pragma comment(lib, "cxcore.lib")
+#pragma comment(lib, "highgui.lib")
+#endif
+
+#include "cv.h"
+#include "cxcore.h"
+#include "highgui.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "filesystem.h"
+#include "icformat.h"
+#include "icbatch.h"
+#include "ichaartraining.h"
+#include "icjournal.h"
+#include "icraw.h"
+#include "icsave.h"
+#include "icshard.h"
+#include "iccache.h"
+#include "icvideo.h"
+#include "icprefetch.h"
+#include "opencvx/cvrect32f.h"
+#include "opencvx/cvcropimageroi.h"
+#if !defined(WIN32) && !defined(WIN64)
+#include <signal.h>
+#include <sys/resource.h>
+#endif
+using namespace std;
+
+int nchecks = 0;
+int nfailures = 0;
+
+#define IC_CHECK( expr ) ic_check( (expr), #expr, __FILE__, __LINE__ )
+
+void ic_check( bool ok, const char* expr, const char* file, int line )
+{
+    nchecks++;
+    if( ok ) return;
+    nfailures++;
+    cerr << file << ":" << line << ": Check failed: " << expr << endl;
+}
+
+/**
+* icFormat as it was before IcFormat, the reference of the equivalence
+*/
+string icFormatReference( const string& format, const string& dirname, const string& filename,
+                          const string& extension, int x, int y, int width, int height,
+                          int frame, int rotation, int shear_x, int shear_y )
+{
+    string ret = format;
+    char tmp[2048];
+    char intkeys[] = { 'x', 'y', 'w', 'h', 'f', 'r', '.', ',' };
+    int  intvals[] = { x, y, width, height, frame, rotation, shear_x, shear_y };
+    int nintkeys = 8;
+    char strkeys[] = { 'i', 'e', 'd' };
+    std::string strvals[] = { filename, extension, dirname };
+    int nstrkeys = 3;
+    for(int i = 0; i < nintkeys + nstrkeys; i++) {
+        std::string::size_type start = ret.find("%");
+        if(start == std::string::npos) break;
+        std::string::size_type minstrpos = std::string::npos;
+        std::string::size_type minintpos = std::string::npos;
+        int minstrkey = INT_MAX; int minintkey = INT_MAX;
+        for(int j = 0; j < nstrkeys; j++) {
+            std::string::size_type pos = ret.find(strkeys[j], start);
+            if(pos < minstrpos) {
+                minstrpos = pos;
+                minstrkey = j;
+            }
+        }
+        for(int j = 0; j < nintkeys; j++) {
+            std::string::size_type pos = ret.find(intkeys[j], start);
+            if(pos < minintpos) {
+                minintpos = pos;
+                minintkey = j;
+            }
+        }
+        if(minstrpos == std::string::npos && minintpos == std::string::npos) break;
+        if(minstrpos < minintpos) {
+            string format_substr = ret.substr(start, minstrpos - start) + "s";
+            std::sprintf(tmp, format_substr.c_str(), strvals[minstrkey].c_str());
+            ret.replace(start, minstrpos - start + 1, string(tmp));
+        } else {
+            string format_substr = ret.substr(start, minintpos - start) + "d";
+            std::sprintf(tmp, format_substr.c_str(), intvals[minintkey]);
+            ret.replace(start, minintpos - start + 1, string(tmp));
+        }
+    }
+    return ret;
+}
+
+/**
+* IcFormat renders as icFormat did, except that icFormat converted again a
+* % which a conversion produced, so no format or value here produces a %
+*/
+void test_format()
+{
+    const char* formats[] = {
+        "%d/imageclipper/%i.%e_%04r_%04x_%04y_%04w_%04h.png",
+        "%d/imageclipper/%i.%e_%04f_%04r_%04x_%04y_%04w_%04h.png",
+        "%d/%i_%x_%y_%w_%h_%._%,.%e",
+        "%i%x%y%w%h",
+        "out/%-6x|%+d|%5.2e|%3h",
+        "no conversion.png",
+        "%d/%i_%08.3x.png",
+        "%d/%i_%5x_%-5y.%e",
+        "%d/%i.%e%",
+        "%i_%r_%._%,.jpg",
+    };
+    const char* dirnames[] = { "", ".", "/data/images", "a dir/with spaces" };
+    const char* filenames[] = { "", "lena", "frame_0001", "x.y" };
+    const char* extensions[] = { "", "png", "JPG" };
+    int ints[] = { 0, 1, -1, 68, 12345, -20000 };
+    srand( 1 );
+    for( size_t f = 0; f < sizeof( formats ) / sizeof( formats[0] ); f++ )
+    {
+        IcFormat format( formats[f] );
+        for( int n = 0; n < 200; n++ )
+        {
+            const char* dirname = dirnames[rand() % 4];
+            const char* filename = filenames[rand() % 4];
+            const char* extension = extensions[rand() % 3];
+            int v[8];
+            for( int i = 0; i < 8; i++ ) v[i] = ints[rand() % 6];
+            IC_CHECK( format( dirname, filename, extension, v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7] ) ==
+                      icFormatReference( formats[f], dirname, filename, extension,
+                                         v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7] ) );
+        }
+    }
+    IC_CHECK( icFormat( "%d/imageclipper/%i.%e_%04r_%04x_%04y_%04w_%04h.png", "img", "lena", "png",
+                        68, 47, 89, 101, 0, 30 ) == "img/imageclipper/lena.png_0030_0068_0047_0089_0101.png" );
+}
+
+void test_natural_less()
+{
+    const char* ordered[] = {
+        "a/b", "a/b/c", "a/frame_2", "a/frame_010", "a/frame_10", "a/frame_10a", "a0", "a1/x", "a2", "a10",
+        "b", "b01", "b1", "b2",
+    };
+    size_t n = sizeof( ordered ) / sizeof( ordered[0] );
+    for( size_t i = 0; i < n; i++ )
+    {
+        IC_CHECK( !filesystem::natural_less( ordered[i], ordered[i] ) );
+        for( size_t j = i + 1; j < n; j++ )
+        {
+            bool ok = filesystem::natural_less( ordered[i], ordered[j] ) &&
+                !filesystem::natural_less( ordered[j], ordered[i] );
+            if( !ok ) cerr << "Not ordered: " << ordered[i] << " < " << ordered[j] << endl;
+            IC_CHECK( ok );
+        }
+    }
+    vector<string> shuffled( ordered, ordered + n );
+    reverse( shuffled.begin(), shuffled.end() );
+    sort( shuffled.begin(), shuffled.end(), filesystem::natural_less );
+    IC_CHECK( equal( shuffled.begin(), shuffled.end(), ordered ) );
+}
+
+void test_extension_set()
+{
+    vector<string> types;
+    types.push_back( "bmp" );
+    types.push_back( "jpg" );
+    types.push_back( "JPEG" );
+    types.push_back( "png" );
+    types.push_back( "extension9" );
+    filesystem::extension_set set( types );
+    IC_CHECK( set.match( "lena.png" ) );
+    IC_CHECK( set.match( "dir/LENA.PNG" ) );
+    IC_CHECK( set.match( "a.jpeg" ) );
+    IC_CHECK( set.match( "a.b.Jpg" ) );
+    IC_CHECK( set.match( "a.EXTENSION9" ) );
+    IC_CHECK( !set.match( "a.extension" ) );
+    IC_CHECK( !set.match( "a.png.txt" ) );
+    IC_CHECK( !set.match( "png" ) );
+    IC_CHECK( !set.match( "a." ) );
+    IC_CHECK( !set.match( "dir.png/a" ) );
+    IC_CHECK( !set.match( "dir.png\\a" ) );
+    IC_CHECK( !set.match( "a.pn" ) );
+    IC_CHECK( !set.match( "a.pngg" ) );
+    IC_CHECK( !filesystem::extension_set().match( "a.png" ) );
+}
+
+void test_manifest()
+{
+    string path = "ictest.tmp/manifest.txt";
+    ofstream ofs( path.c_str(), ios::out | ios::binary );
+    ofs << "# filename x y width height [rotation [shear_x shear_y]]\n"
+        << "\n"
+        << "lena.png 68 47 89 101\r\n"
+        << "  sky.jpg 1 2 3 4 30\n"
+        << "sky.jpg 1 2 3 4 -15 5 -6\n"
+        << "broken.png 1 2\n"
+        << "\t# indented comment\n"
+        << "last.png 0 0 1 1";
+    ofs.close();
+    vector<IcBatchRegion> regions;
+    IC_CHECK( icReadBatchManifest( path, regions ) );
+    IC_CHECK( regions.size() == 4 );
+    if( regions.size() != 4 ) return;
+    IC_CHECK( regions[0].filename == "lena.png" && regions[0].rect.x == 68 && regions[0].rect.y == 47 &&
+              regions[0].rect.width == 89 && regions[0].rect.height == 101 &&
+              regions[0].rotate == 0 && regions[0].shear.x == 0 && regions[0].shear.y == 0 );
+    IC_CHECK( regions[1].filename == "sky.jpg" && regions[1].rotate == 30 && regions[1].shear.x == 0 );
+    IC_CHECK( regions[2].rotate == -15 && regions[2].shear.x == 5 && regions[2].shear.y == -6 );
+    IC_CHECK( regions[3].filename == "last.png" && regions[3].rect.width == 1 );
+    IC_CHECK( !icReadBatchManifest( "ictest.tmp/no such manifest", regions ) );
+}
+
+void test_parse_clipped()
+{
+    IcFormat format( "%d/imageclipper/%i.%e_%04r_%04x_%04y_%04w_%04h.png" );
+    string source;
+    CvRect rect;
+    int rotation;
+    CvPoint shear;
+    IC_CHECK( IcHaarTrainingWriter::parse_clipped( "image.jpg_0030_0068_0047_0089_0101.png", format,
+                                                   source, rect, rotation, shear ) );
+    IC_CHECK( source == "image.jpg" && rect.x == 68 && rect.y == 47 && rect.width == 89 && rect.height == 101 &&
+              rotation == 30 && shear.x == 0 && shear.y == 0 );
+    // underscores and digits in the source name stay in the name
+    IC_CHECK( IcHaarTrainingWriter::parse_clipped( "img_2010_01.jpg_0000_0001_0002_0003_0004.png", format,
+                                                   source, rect, rotation, shear ) );
+    IC_CHECK( source == "img_2010_01.jpg" && rect.x == 1 && rect.height == 4 );
+    IC_CHECK( !IcHaarTrainingWriter::parse_clipped( "image.jpg_0000_0068_0047_0089.png", format,
+                                                    source, rect, rotation, shear ) );
+    IC_CHECK( !IcHaarTrainingWriter::parse_clipped( "image.jpg_0000_0068_0047_0089_0101.jpg", format,
+                                                    source, rect, rotation, shear ) );
+
+    IcFormat sheared( "%d/%i_%x_%y_%w_%h_%r_%._%,.%e" );
+    IC_CHECK( IcHaarTrainingWriter::parse_clipped( "a_b_-1_2_30_40_-90_5_-6.png", sheared,
+                                                   source, rect, rotation, shear ) );
+    IC_CHECK( source == "a_b.png" && rect.x == -1 && rect.width == 30 && rotation == -90 &&
+              shear.x == 5 && shear.y == -6 );
+    IC_CHECK( !IcHaarTrainingWriter::parse_clipped( "a_1_2_3_4.png", IcFormat( "%d/%i_%x_%y.png" ),
+                                                    source, rect, rotation, shear ) );
+
+    // every name rendered by a format parses back
+    const char* names[] = { "lena", "a_1", "2010_01_01", "x.y_9" };
+    srand( 2 );
+    for( int n = 0; n < 1000; n++ )
+    {
+        int v[8];
+        for( int i = 0; i < 8; i++ ) v[i] = rand() % 20001 - 10000;
+        string name = names[rand() % 4];
+        string clipped = filesystem::basename( sheared( "dir", name, "png", v[0], v[1], v[2], v[3], 0, v[5], v[6], v[7] ) );
+        bool ok = IcHaarTrainingWriter::parse_clipped( clipped, sheared, source, rect, rotation, shear );
+        IC_CHECK( ok && source == name + ".png" && rect.x == v[0] && rect.y == v[1] && rect.width == v[2] &&
+                  rect.height == v[3] && rotation == v[5] && shear.x == v[6] && shear.y == v[7] );
+    }
+}
+
+void test_haartraining()
+{
+    // the GUI, --batch and --collect name one image alike
+    IcHaarTrainingWriter positives;
+    IC_CHECK( positives.add( "./images/lena.jpg", cvRect( 87, 66, 90, 80 ) ) );
+    IC_CHECK( positives.add( "lena.jpg", cvRect( 68, 47, 89, 101 ) ) );
+    IC_CHECK( positives.add_clipped( "lena.jpg_0000_0095_0105_0033_0032.png",
+                                     IcFormat( "%d/imageclipper/%i.%e_%04r_%04x_%04y_%04w_%04h.png" ) ) );
+    IC_CHECK( !positives.add( "images/sky.jpg", cvRect( 1, 2, 3, 4 ), 30 ) );
+    IC_CHECK( positives.add( "/data/images/sky.jpg", cvRect( 1, 2, 3, 4 ) ) );
+    IC_CHECK( positives.size() == 4 && positives.skipped() == 1 );
+    string path = "ictest.tmp/info.dat";
+    IC_CHECK( positives.write( path ) );
+    ifstream ifs( path.c_str() );
+    string line;
+    IC_CHECK( getline( ifs, line ) && line == "lena.jpg 3 68 47 89 101 87 66 90 80 95 105 33 32" );
+    IC_CHECK( getline( ifs, line ) && line == "sky.jpg 1 1 2 3 4" );
+    IC_CHECK( !getline( ifs, line ) );
+}
+
+void test_journal()
+{
+    string path = "ictest.tmp/journal.icj";
+    remove( path.c_str() );
+    remove( ( path + ".names" ).c_str() );
+    const int n = 5000;
+    for( int pass = 0; pass < 2; pass++ )
+    {
+        IcJournal journal( path );
+        IC_CHECK( journal.opened() );
+        for( int i = pass * n / 2; i < ( pass + 1 ) * n / 2; i++ )
+        {
+            ostringstream source, output;
+            source << "src/" << i % 7 << ".png";
+            output << "out/" << i << ".png";
+            IC_CHECK( journal.append( source.str(), output.str(), i % 3, cvRect( i, -i, i + 1, i + 2 ), i % 360,
+                                      cvPoint( i % 5, -( i % 5 ) ) ) );
+        }
+        IC_CHECK( journal.size() == (size_t)( pass + 1 ) * n / 2 );
+    }
+    vector<IcJournalRecord> records;
+    vector<string> names;
+    IC_CHECK( IcJournal::load( path, records, names ) );
+    IC_CHECK( records.size() == (size_t)n );
+    for( size_t i = 0; i < records.size(); i++ )
+    {
+        const IcJournalRecord& r = records[i];
+        int k = (int)i;
+        ostringstream source, output;
+        source << "src/" << k % 7 << ".png";
+        output << "out/" << k << ".png";
+        bool ok = r.source < names.size() && r.output < names.size() && names[r.source] == source.str() &&
+            names[r.output] == output.str() && r.frame == k % 3 && r.x == k && r.y == -k &&
+            r.width == k + 1 && r.height == k + 2 && r.rotation == k % 360 &&
+            r.shear_x == k % 5 && r.shear_y == -( k % 5 );
+        if( !ok )
+        {
+            IC_CHECK( ok );
+            break;
+        }
+    }
+#if !defined(WIN32) && !defined(WIN64)
+    {
+        // a name which fails half way, by a limit of the file size, fails its record only
+        IcJournal journal( path );
+        struct rlimit limit, saved;
+        getrlimit( RLIMIT_FSIZE, &saved );
+        void (*handler)( int ) = signal( SIGXFSZ, SIG_IGN );
+        limit = saved;
+        limit.rlim_cur = filesystem::filesize( path + ".names" ) + 10;
+        setrlimit( RLIMIT_FSIZE, &limit );
+        bool ok = journal.append( "src/0.png", "out/" + string( 100, 'x' ) + ".png", 0, cvRect( 0, 0, 1, 1 ), 0,
+                                  cvPoint( 0, 0 ) );
+        setrlimit( RLIMIT_FSIZE, &saved );
+        signal( SIGXFSZ, handler );
+        IC_CHECK( !ok );
+        IC_CHECK( journal.append( "src/0.png", "out/last.png", 0, cvRect( 0, 0, 1, 1 ), 0, cvPoint( 0, 0 ) ) );
+    }
+    IC_CHECK( IcJournal::load( path, records, names ) );
+    IC_CHECK( records.size() == (size_t)n + 1 );
+    IC_CHECK( !records.empty() && records.back().output < names.size() && names[records.back().output] == "out/last.png" );
+#endif
+    // a journal whose names are lost is refused
+    remove( ( path + ".names" ).c_str() );
+    IC_CHECK( !IcJournal::load( path, records, names ) );
+    IcJournal orphan( path );
+    IC_CHECK( !orphan.opened() );
+}
+
+void test_raw()
+{
+    string prefix = "ictest.tmp/raw";
+    remove( ( prefix + ".raw" ).c_str() );
+    remove( ( prefix + ".raw.names" ).c_str() );
+    CvSize size = cvSize( 4, 3 );
+    const int n = 10;
+    for( int pass = 0; pass < 2; pass++ )
+    {
+        IcRawSink sink( size );
+        for( int i = pass * n / 2; i < ( pass + 1 ) * n / 2; i++ )
+        {
+            IplImage* img = cvCreateImage( size, IPL_DEPTH_8U, 3 );
+            for( int y = 0; y < size.height; y++ )
+            {
+                for( int x = 0; x < size.width; x++ )
+                {
+                    uchar* p = (uchar*)img->imageData + img->widthStep * y + x * 3;
+                    p[0] = (uchar)i;        // B
+                    p[1] = (uchar)( x + 16 * y );
+                    p[2] = (uchar)( 255 - i ); // R
+                }
+            }
+            ostringstream name;
+            name << prefix << "/" << i << ".png";
+            IC_CHECK( sink.write( name.str(), img ) );
+            cvReleaseImage( &img );
+        }
+        IplImage* deep = cvCreateImage( size, IPL_DEPTH_16U, 3 );
+        IC_CHECK( !sink.write( prefix + "/16bit.png", deep ) );
+        cvReleaseImage( &deep );
+        IC_CHECK( sink.sync() );
+    }
+    ifstream ifs( ( prefix + ".raw" ).c_str(), ios::in | ios::binary );
+    IcRawHeader header;
+    IC_CHECK( ifs.read( (char*)&header, sizeof( header ) ) );
+    IC_CHECK( memcmp( header.magic, "ICRAW1", 7 ) == 0 && header.header_size == sizeof( header ) &&
+              header.width == 4 && header.height == 3 && header.channels == 3 &&
+              memcmp( header.order, "RGB", 4 ) == 0 && header.count == (boost::uint64_t)n );
+    vector<char> data( 4 * 3 * 3 );
+    for( int i = 0; i < n && ifs.read( &data[0], data.size() ); i++ )
+    {
+        bool ok = true;
+        for( int y = 0; y < 3; y++ )
+        {
+            for( int x = 0; x < 4; x++ )
+            {
+                const uchar* p = (const uchar*)&data[( y * 4 + x ) * 3];
+                ok = ok && p[0] == (uchar)( 255 - i ) && p[1] == (uchar)( x + 16 * y ) && p[2] == (uchar)i;
+            }
+        }
+        IC_CHECK( ok );
+    }
+    ifstream names( ( prefix + ".raw.names" ).c_str() );
+    string line;
+    int nnames = 0;
+    while( getline( names, line ) )
+    {
+        ostringstream name;
+        name << nnames++ << ".png";
+        IC_CHECK( line == name.str() );
+    }
+    IC_CHECK( nnames == n );
+    names.close();
+    // names left beyond the count by a crash are dropped
+    {
+        FILE* fp = fopen( ( prefix + ".raw.names" ).c_str(), "ab" );
+        fputs( "lost.png\nhalf.p", fp );
+        fclose( fp );
+        IcRawSink sink( size );
+        IplImage* img = cvCreateImage( size, IPL_DEPTH_8U, 3 );
+        cvZero( img );
+        IC_CHECK( sink.write( prefix + "/10.png", img ) );
+        cvReleaseImage( &img );
+    }
+    names.open( ( prefix + ".raw.names" ).c_str() );
+    nnames = 0;
+    while( getline( names, line ) )
+    {
+        ostringstream name;
+        name << nnames++ << ".png";
+        IC_CHECK( line == name.str() );
+    }
+    IC_CHECK( nnames == n + 1 );
+    // a file of another shape is refused
+    IcRawSink other( cvSize( 8, 8 ) );
+    IplImage* img = cvCreateImage( size, IPL_DEPTH_8U, 3 );
+    cvZero( img );
+    IC_CHECK( !other.write( prefix + "/other.png", img ) );
+    cvReleaseImage( &img );
+}
+
+void test_crop()
+{
+    // the vectorized kernels against the original per-pixel loop
+    srand( 3 );
+    int channels[] = { 1, 3, 4 };
+    for( int c = 0; c < 3; c++ )
+    {
+        IplImage* img = cvCreateImage( cvSize( 97, 61 ), IPL_DEPTH_8U, channels[c] );
+        for( int i = 0; i < img->imageSize; i++ ) img->imageData[i] = (char)rand();
+        for( int n = 0; n < 100; n++ )
+        {
+            CvRect32f rect = cvRect32f( rand() % 120 - 10, rand() % 80 - 10, rand() % 40 + 1, rand() % 40 + 1,
+                                        n % 4 == 0 ? 0 : rand() % 360 );
+            CvPoint2D32f shear = n % 3 == 0 ? cvPoint2D32f( ( rand() % 21 - 10 ) / 10.0, ( rand() % 21 - 10 ) / 10.0 )
+                                            : cvPoint2D32f( 0, 0 );
+            CvSize size = cvSize( cvRectFromRect32f( rect ).width, cvRectFromRect32f( rect ).height );
+            IplImage* dst = cvCreateImage( size, IPL_DEPTH_8U, img->nChannels );
+            IplImage* ref = cvCreateImage( size, IPL_DEPTH_8U, img->nChannels );
+            cvCropImageROI( img, dst, rect, shear );
+            cvCropImageROI( img, ref, rect, shear, CV_CROP_REFERENCE );
+            int ndiffs = 0;
+            for( int y = 0; y < size.height; y++ )
+            {
+                for( int x = 0; x < size.width * img->nChannels; x++ )
+                {
+                    ndiffs += dst->imageData[(size_t)dst->widthStep * y + x] !=
+                        ref->imageData[(size_t)ref->widthStep * y + x];
+                }
+            }
+            // the reference maps a sheared rectangle in float, which rounds
+            // a few pixels on the other side
+            if( shear.x == 0 && shear.y == 0 )
+                IC_CHECK( ndiffs == 0 );
+            else
+                IC_CHECK( ndiffs <= 1 + size.width * size.height * img->nChannels / 50 );
+            cvReleaseImage( &dst );
+            cvReleaseImage( &ref );
+        }
+        cvReleaseImage( &img );
+    }
+}
+
+int ncompleted = 0; /**< completions called by the writer thread */
+
+void count_completed()
+{
+    ncompleted++;
+}
+
+void test_save_queue()
+{
+    string dir = "ictest.tmp/save";
+    boost::filesystem::remove_all( boost::filesystem::path( dir ) );
+    IplImage* img = cvCreateImage( cvSize( 8, 8 ), IPL_DEPTH_8U, 3 );
+    cvZero( img );
+    IcSaveQueue saver;
+    saver.push( dir + "/a/1.png", cvCloneImage( img ), boost::bind( &count_completed ) );
+    saver.flush();
+    IC_CHECK( ncompleted == 1 && filesystem::exists( dir + "/a/1.png" ) );
+    // a directory removed after it was made is made again
+    boost::filesystem::remove_all( boost::filesystem::path( dir ) );
+    saver.push( dir + "/a/2.png", cvCloneImage( img ), boost::bind( &count_completed ) );
+    saver.flush();
+    IC_CHECK( ncompleted == 2 && filesystem::exists( dir + "/a/2.png" ) );
+    // no image, e.g., of a file failed to be decoded, is not completed
+    saver.push( dir + "/a/3.png", NULL, boost::bind( &count_completed ) );
+    saver.flush();
+    IC_CHECK( ncompleted == 2 && !filesystem::exists( dir + "/a/3.png" ) );
+    cvReleaseImage( &img );
+}
+
+/**
+* Read the members of a tar archive
+*
+* @return false if a header is broken before the terminating zero block
+*/
+bool read_tar( const string& path, vector<string>& names )
+{
+    ifstream ifs( path.c_str(), ios::in | ios::binary );
+    if( !ifs ) return false;
+    char header[512];
+    while( ifs.read( header, 512 ) )
+    {
+        if( header[0] == 0 ) return true;
+        unsigned long checksum = 0, size = 0, expected = strtoul( header + 148, NULL, 8 );
+        memset( header + 148, ' ', 8 );
+        for( int i = 0; i < 512; i++ ) checksum += (unsigned char)header[i];
+        if( checksum != expected ) return false;
+        size = strtoul( header + 124, NULL, 8 );
+        if( header[156] == '0' ) names.push_back( string( header, strnlen( header, 100 ) ) );
+        if( !ifs.seekg( ( size + 511 ) / 512 * 512, ios::cur ) ) return false;
+    }
+    return ifs.eof() && ifs.gcount() == 0;
+}
+
+void test_tar()
+{
+    string prefix = "ictest.tmp/tar";
+    char suffix[32];
+    for( int i = 0; i < 100; i++ )
+    {
+        sprintf( suffix, "-%05d.tar", i );
+        remove( ( prefix + suffix ).c_str() );
+    }
+    IplImage* img = cvCreateImage( cvSize( 16, 16 ), IPL_DEPTH_8U, 3 );
+    cvZero( img );
+    vector<string> written;
+    {
+        IcTarSink sink( 64 * 1024 );
+        for( int i = 0; i < 12; i++ )
+        {
+            ostringstream name;
+            name << i << ".bmp";
+#if !defined(WIN32) && !defined(WIN64)
+            // a member which fails half way, by a limit of the file size
+            struct rlimit limit, saved;
+            getrlimit( RLIMIT_FSIZE, &saved );
+            void (*handler)( int ) = signal( SIGXFSZ, SIG_IGN );
+            if( i == 5 )
+            {
+                limit = saved;
+                limit.rlim_cur = filesystem::filesize( prefix + "-00000.tar" ) + 600;
+                setrlimit( RLIMIT_FSIZE, &limit );
+            }
+            bool ok = sink.write( prefix + "/" + name.str(), img );
+            setrlimit( RLIMIT_FSIZE, &saved );
+            signal( SIGXFSZ, handler );
+            IC_CHECK( ok == ( i != 5 ) );
+#else
+            bool ok = sink.write( prefix + "/" + name.str(), img );
+            IC_CHECK( ok );
+#endif
+            if( ok ) written.push_back( name.str() );
+        }
+    }
+    cvReleaseImage( &img );
+    vector<string> names;
+    for( int i = 0; filesystem::exists( prefix + ( sprintf( suffix, "-%05d.tar", i ), suffix ) ); i++ )
+    {
+        IC_CHECK( read_tar( prefix + suffix, names ) );
+    }
+    IC_CHECK( names == written );
+}
+
+void test_prefetch()
+{
+    const int n = 10;
+    vector<filesystem::file_entry> filelist;
+    IplImage* img = cvCreateImage( cvSize( 8, 8 ), IPL_DEPTH_8U, 3 );
+    cvZero( img );
+    for( int i = 0; i < n; i++ )
+    {
+        ostringstream path;
+        path << "ictest.tmp/prefetch_" << i << ".png";
+        cvSaveImage( path.str().c_str(), img );
+        filelist.push_back( filesystem::decompose( path.str() ) );
+    }
+    cvReleaseImage( &img );
+    IcImageCache cache( 64 * 1024 * 1024 );
+    {
+        IcPrefetcher prefetcher( filelist, &cache, 1 );
+        // nothing near the beginning is decoded before the resumed image is got
+        boost::this_thread::sleep( boost::posix_time::milliseconds( 200 ) );
+        bool decoded = false;
+        for( int i = 0; i < n; i++ ) decoded = decoded || cache.contains( filelist[i].path );
+        IC_CHECK( !decoded );
+        IC_CHECK( prefetcher.get( 7 ) != NULL );
+        for( int i = 0; i < 100 && !( cache.contains( filelist[6].path ) && cache.contains( filelist[8].path ) ); i++ )
+        {
+            boost::this_thread::sleep( boost::posix_time::milliseconds( 10 ) );
+        }
+        IC_CHECK( cache.contains( filelist[6].path ) && cache.contains( filelist[8].path ) );
+        IC_CHECK( !cache.contains( filelist[0].path ) && !cache.contains( filelist[1].path ) );
+    }
+}
+
+/** @return true if the image is the frame of the video of test_video() */
+bool is_frame( const IplImage* img, int frame )
+{
+    return img != NULL && abs( (uchar)img->imageData[0] - 2 * frame ) <= 4; // lossy codec
+}
+
+void test_video()
+{
+    string path = "ictest.tmp/video.avi";
+    remove( path.c_str() );
+    remove( ( path + ".icindex" ).c_str() );
+    const int n = 100;
+    CvVideoWriter* writer = cvCreateVideoWriter( path.c_str(), CV_FOURCC( 'M', 'J', 'P', 'G' ), 25, cvSize( 64, 48 ) );
+    if( writer == NULL )
+    {
+        cerr << "Checks of videos are skipped. No MJPG encoder." << endl;
+        return;
+    }
+    IplImage* img = cvCreateImage( cvSize( 64, 48 ), IPL_DEPTH_8U, 3 );
+    for( int i = 1; i <= n; i++ )
+    {
+        memset( img->imageData, 2 * i, img->imageSize );
+        cvWriteFrame( writer, img );
+    }
+    cvReleaseVideoWriter( &writer );
+    cvReleaseImage( &img );
+
+    IcImageCache cache( 1 ); // keeps the pinned frame only, to decode every time
+    {
+        // an end reached after a seek to a block without a checkpoint is not learned
+        IcVideoReader video( path, &cache, 8 );
+        IC_CHECK( video.opened() );
+        for( int i = 53; i <= n + 1 && video.get( i ) != NULL; i++ );
+    }
+    IC_CHECK( !filesystem::exists( path + ".icindex" ) );
+    {
+        IcVideoReader video( path, &cache, 8 );
+        for( int i = 1; i <= n; i++ ) IC_CHECK( is_frame( video.get( i ), i ) );
+        IC_CHECK( video.get( n + 1 ) == NULL );
+        IC_CHECK( video.frame_count() == n );
+    }
+    {
+        // seeks to the checkpoints recorded above
+        IcVideoReader video( path, &cache, 8 );
+        IC_CHECK( video.frame_count() == n );
+        int frames[] = { 77, 3, 100, 50, 49, 9, 8, 1 };
+        for( size_t i = 0; i < sizeof( frames ) / sizeof( frames[0] ); i++ )
+        {
+            IC_CHECK( is_frame( video.get( frames[i] ), frames[i] ) );
+        }
+        IC_CHECK( video.get( n + 1 ) == NULL );
+    }
+}
+
+int main()
+{
+    filesystem::r_mkdir( "ictest.tmp" );
+    test_format();
+    test_natural_less();
+    test_extension_set();
+    test_manifest();
+    test_parse_clipped();
+    test_haartraining();
+    test_journal();
+    test_raw();
+    test_crop();
+    test_save_queue();
+    test_prefetch();
+    test_tar();
+    test_video();
+    cout << nchecks - nfailures << " of " << nchecks << " checks passed." << endl;
+    return nfailures == 0 ? 0 : 1;
+}
@@ -0,0 +1,190 @@
+/** @file
+*
+* Image clipper work-stealing thread pool
+*
+* The MIT License
+*
+* Copyright (c) 2008, Naotoshi Seo <sonots(at)umd.edu>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#ifndef IC_THREADPOOL_INCLUDED
+#define IC_THREADPOOL_INCLUDED
+
+#include <iostream>
+#include <deque>
+#include <vector>
+#include <exception>
+#include <boost/thread.hpp>
+#include <boost/function.hpp>
+#include <boost/bind.hpp>
+using namespace std;
+
+/**
+* A fixed size thread pool with work stealing
+*
+* Every worker owns a task deque. A worker takes tasks from the back of
+* its own deque and steals from the front of the others' when it runs out.
+* Tasks pushed from inside a task go to the deque of the running worker,
+* so recursive work stays local until somebody becomes idle.
+*/
+class IcThreadPool {
+public:
+    typedef boost::function<void ()> Task;
+
+    /**
+    * @param [nthreads = 0] The number of workers. 0 for the number of cores.
+    */
+    explicit IcThreadPool( int nthreads = 0 )
+        : pending( 0 ), queued( 0 ), stopping( false ), next( 0 )
+    {
+        if( nthreads <= 0 ) nthreads = hardware_concurrency();
+        for( int i = 0; i < nthreads; i++ )
+        {
+            workers.push_back( new Worker() );
+        }
+        for( int i = 0; i < nthreads; i++ )
+        {
+            threads.create_thread( boost::bind( &IcThreadPool::run, this, i ) );
+        }
+    }
+
+    ~IcThreadPool()
+    {
+        wait();
+        {
+            boost::mutex::scoped_lock lock( mutex );
+            stopping = true;
+        }
+        wakeup.notify_all();
+        threads.join_all();
+        for( size_t i = 0; i < workers.size(); i++ ) delete workers[i];
+    }
+
+    /**
+    * Queue a task
+    */
+    void push( const Task& task )
+    {
+        int* id = current.get();
+        Worker* worker;
+        {
+            boost::mutex::scoped_lock lock( mutex );
+            pending++;
+            queued++;
+            worker = workers[ id != NULL ? *id : next++ % workers.size() ];
+        }
+        {
+            boost::mutex::scoped_lock lock( worker->mutex );
+            worker->tasks.push_back( task );
+        }
+        wakeup.notify_one();
+    }
+
+    /**
+    * Block until all queued tasks (and tasks queued by them) finished
+    */
+    void wait()
+    {
+        boost::mutex::scoped_lock lock( mutex );
+        while( pending > 0 ) idle.wait( lock );
+    }
+
+    int size() const
+    {
+        return (int)workers.size();
+    }
+
+    static int hardware_concurrency()
+    {
+        return max( 1, (int)boost::thread::hardware_concurrency() );
+    }
+
+private:
+    struct Worker {
+        boost::mutex mutex;
+        deque<Task> tasks;
+    };
+
+    bool pop( int id, Task& task )
+    {
+        for( size_t i = 0; i < workers.size(); i++ )
+        {
+            Worker* worker = workers[( id + i ) % workers.size()];
+            boost::mutex::scoped_lock lock( worker->mutex );
+            if( worker->tasks.empty() ) continue;
+            if( i == 0 ) // own deque
+            {
+                task = worker->tasks.back();
+                worker->tasks.pop_back();
+            }
+            else // steal
+            {
+                task = worker->tasks.front();
+                worker->tasks.pop_front();
+            }
+            return true;
+        }
+        return false;
+    }
+
+    void run( int id )
+    {
+        current.reset( new int( id ) );
+        while( true )
+        {
+            Task task;
+            if( pop( id, task ) )
+            {
+                {
+                    boost::mutex::scoped_lock lock( mutex );
+                    queued--;
+                }
+                try
+                {
+                    task();
+                }
+                catch( const std::exception& e )
+                {
+                    cerr << e.what() << endl;
+                }
+                boost::mutex::scoped_lock lock( mutex );
+                if( --pending == 0 ) idle.notify_all();
+                continue;
+            }
+            boost::mutex::scoped_lock lock( mutex );
+            while( queued == 0 && !stopping ) wakeup.wait( lock );
+            if( queued == 0 && stopping ) return;
+        }
+    }
+
+    vector<Worker*> workers;
+    boost::thread_group threads;
+    boost::thread_specific_ptr<int> current; /**< worker id of the calling thread */
+    boost::mutex mutex;
+    boost::condition_variable wakeup;        /**< a task is queued */
+    boost::condition_variable idle;          /**< all tasks finished */
+    int pending;                             /**< tasks queued or running */
+    int queued;                              /**< tasks not taken by a worker yet */
+    bool stopping;
+    unsigned int next;                       /**< round robin for outside pushes */
+};
+
+#endif
@@ -0,0 +1,334 @@
+/** @file
+*
+* Image clipper memory mapped access to images larger than memory
+*
+* The MIT License
+*
+* Copyright (c) 2008, Naotoshi Seo <sonots(at)umd.edu>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#ifndef IC_TILED_INCLUDED
+#define IC_TILED_INCLUDED
+
+#include "cv.h"
+#include "cxcore.h"
+#include <stdio.h>
+#include <ctype.h>
+#include <string.h>
+#include <iostream>
+#include <string>
+#include <list>
+#include <map>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include "filesystem.h"
+#include "opencvx/cvrect32f.h"
+#include "opencvx/cvcropimageroi.h"
+using namespace std;
+
+/**
+* An 8-bit binary PNM (P5 gray or P6 color) image read through memory
+* mapping
+*
+* Pixels are never decoded as a whole. The file is mapped in bands of
+* rows on demand, and the least recently used bands are unmapped to keep
+* at most budget bytes mapped, so an image larger than memory can be
+* shown and clipped. Regions are copied out as 3 channel 8U images in BGR
+* order, gray ones included, as cvLoadImage loads images.
+*
+* Other formats, e.g., TIFF mosaics, have to be converted to binary PNM
+* beforehand (raw pixels are the only format which can be mapped as is).
+*/
+class IcTiledImage {
+public:
+    /**
+    * @param path              The image filename
+    * @param budget            The maximum bytes mapped at once
+    * @param [band_rows = 64]  The number of rows mapped together
+    */
+    IcTiledImage( const string& path, size_t budget, int band_rows = 64 )
+        : width( 0 ), height( 0 ), channels( 0 ), budget( budget ), band_rows( max( 1, band_rows ) ),
+          data_offset( 0 ), bytes( 0 ), file( NULL ), last_band( -1 ), last_base( NULL )
+    {
+        if( !read_header( path, width, height, channels, data_offset ) ) return;
+        try
+        {
+            file = new boost::interprocess::file_mapping( path.c_str(), boost::interprocess::read_only );
+        }
+        catch( const boost::interprocess::interprocess_exception& e )
+        {
+            cerr << "Failed to map " << path << ": " << e.what() << endl;
+            width = height = channels = 0;
+        }
+    }
+
+    ~IcTiledImage()
+    {
+        for( map<int, boost::interprocess::mapped_region*>::iterator it = bands.begin(); it != bands.end(); ++it )
+        {
+            delete it->second;
+        }
+        delete file;
+    }
+
+    bool opened() const
+    {
+        return file != NULL;
+    }
+
+    CvSize size() const
+    {
+        return cvSize( width, height );
+    }
+
+    /** @return 3, the channels of regions copied out */
+    int nchannels() const
+    {
+        return 3;
+    }
+
+    /**
+    * Copy a region of the image shrunk by 2^shift (nearest neighbor)
+    *
+    * @param rect       The region in the shrunk image coordinates
+    * @param dst        8UC3 matrix of rect size. Pixels outside of the
+    *                   image are set to 0.
+    * @param [shift=0]  The shrink level
+    */
+    void read( CvRect rect, CvMat* dst, int shift = 0 )
+    {
+        for( int y = 0; y < rect.height; y++ )
+        {
+            uchar* d = dst->data.ptr + dst->step * y;
+            int sy = ( rect.y + y ) << shift;
+            if( rect.y + y < 0 || sy >= height )
+            {
+                memset( d, 0, rect.width * 3 );
+                continue;
+            }
+            const uchar* s = row( sy );
+            for( int x = 0; x < rect.width; x++, d += 3 )
+            {
+                int sx = ( rect.x + x ) << shift;
+                if( rect.x + x < 0 || sx >= width )
+                {
+                    memset( d, 0, 3 );
+                }
+                else if( channels == 3 ) // RGB to BGR
+                {
+                    const uchar* p = s + sx * 3;
+                    d[0] = p[2]; d[1] = p[1]; d[2] = p[0];
+                }
+                else // gray to BGR
+                {
+                    d[0] = d[1] = d[2] = s[sx];
+                }
+            }
+        }
+    }
+
+    /**
+    * Copy a region into a new image
+    *
+    * @param rect       The region in the shrunk image coordinates
+    * @param [shift=0]  The shrink level
+    * @return The image. Release it.
+    */
+    IplImage* read( CvRect rect, int shift = 0 )
+    {
+        IplImage* img = cvCreateImage( cvSize( rect.width, rect.height ), IPL_DEPTH_8U, 3 );
+        CvMat hdr;
+        read( rect, cvGetMat( img, &hdr ), shift );
+        return img;
+    }
+
+    /**
+    * Crop a rotated and sheared rectangle touching only the rows under it
+    *
+    * @see cvCropImageROI
+    * @param dst  8U image of the rectangle size
+    */
+    void crop( IplImage* dst, CvRect32f rect32f, CvPoint2D32f shear )
+    {
+        crop_scaled( dst, rect32f, shear, 0 );
+    }
+
+    /**
+    * Crop a rotated and sheared rectangle into dst of any size from the
+    * image shrunk by 2^shift
+    *
+    * @see cvCropImageROIScaled
+    */
+    void crop_scaled( IplImage* dst, CvRect32f rect32f, CvPoint2D32f shear, int shift )
+    {
+        // the bounding box of the rectangle in the shrunk image
+        float scale = 1.0f / ( 1 << shift );
+        CvRect32f rect = cvRect32f( rect32f.x * scale, rect32f.y * scale,
+                                    max( 1.0f, rect32f.width * scale ),
+                                    max( 1.0f, rect32f.height * scale ), rect32f.angle );
+        CvPoint2D32f sh = cvPoint2D32f( shear.x * scale, shear.y * scale );
+        CvPoint2D32f pt[4];
+        icvCropCorners( rect, sh, pt );
+        float x1 = pt[0].x, y1 = pt[0].y, x2 = pt[0].x, y2 = pt[0].y;
+        for( int i = 1; i < 4; i++ )
+        {
+            x1 = min( x1, pt[i].x ); y1 = min( y1, pt[i].y );
+            x2 = max( x2, pt[i].x ); y2 = max( y2, pt[i].y );
+        }
+        int swidth = ( ( width - 1 ) >> shift ) + 1, sheight = ( ( height - 1 ) >> shift ) + 1;
+        // even so that cvRound (half to even) of shifted coordinates does not change
+        int bx1 = max( 0, cvFloor( x1 ) - 2 ) & ~1, by1 = max( 0, cvFloor( y1 ) - 2 ) & ~1;
+        int bx2 = min( swidth, cvCeil( x2 ) + 2 ), by2 = min( sheight, cvCeil( y2 ) + 2 );
+        if( bx1 >= bx2 || by1 >= by2 )
+        {
+            cvZero( dst );
+            return;
+        }
+        CvRect box = cvRect( bx1, by1, bx2 - bx1, by2 - by1 );
+        IplImage* region = read( box, shift );
+        rect.x -= box.x;
+        rect.y -= box.y;
+        CvRect irect = cvRectFromRect32f( rect );
+        if( dst->width == irect.width && dst->height == irect.height )
+            cvCropImageROI( region, dst, rect, sh );
+        else
+            cvCropImageROIScaled( region, dst, rect, sh );
+        cvReleaseImage( &region );
+    }
+
+    /**
+    * @return true if the file is a binary PNM which can be read by
+    *         IcTiledImage and larger than the threshold. false if it
+    *         does not exist (any more).
+    */
+    static bool is_tiled( const string& path, size_t threshold )
+    {
+        if( size_of( path ) <= threshold ) return false;
+        int w, h, cn;
+        size_t offset;
+        return read_header( path, w, h, cn, offset );
+    }
+
+private:
+    /** Parse the header of an 8-bit binary PNM */
+    static bool read_header( const string& path, int& w, int& h, int& cn, size_t& offset )
+    {
+        FILE* fp = fopen( path.c_str(), "rb" );
+        if( fp == NULL ) return false;
+        char magic[3] = { 0 };
+        int maxval = 0;
+        bool ok = fread( magic, 1, 2, fp ) == 2 && magic[0] == 'P' && ( magic[1] == '5' || magic[1] == '6' );
+        ok = ok && read_int( fp, w ) && read_int( fp, h ) && read_int( fp, maxval );
+        ok = ok && w > 0 && h > 0 && maxval > 0 && maxval < 256;
+        if( ok )
+        {
+            cn = magic[1] == '6' ? 3 : 1;
+            offset = (size_t)ftell( fp ) + 1; // a single white space after maxval
+            ok = (double)size_of( path ) >= (double)offset + (double)w * h * cn;
+        }
+        fclose( fp );
+        return ok;
+    }
+
+    /** The file size, 0 if it was removed, not to throw in the prefetch thread */
+    static size_t size_of( const string& path )
+    {
+        try
+        {
+            return filesystem::filesize( path );
+        }
+        catch( const boost::filesystem::filesystem_error& )
+        {
+            return 0;
+        }
+    }
+
+    /** Read a decimal skipping white spaces and comments */
+    static bool read_int( FILE* fp, int& value )
+    {
+        int c = fgetc( fp );
+        while( c != EOF && ( isspace( c ) || c == '#' ) )
+        {
+            if( c == '#' ) while( c != EOF && c != '\n' ) c = fgetc( fp );
+            c = fgetc( fp );
+        }
+        if( c == EOF || !isdigit( c ) ) return false;
+        value = 0;
+        while( c != EOF && isdigit( c ) )
+        {
+            value = value * 10 + ( c - '0' );
+            c = fgetc( fp );
+        }
+        ungetc( c, fp );
+        return true;
+    }
+
+    /** A row, mapping its band if not yet */
+    const uchar* row( int y )
+    {
+        int band = y / band_rows;
+        size_t rowbytes = (size_t)width * channels;
+        if( band == last_band ) return last_base + rowbytes * ( y - band * band_rows );
+        map<int, boost::interprocess::mapped_region*>::iterator it = bands.find( band );
+        if( it == bands.end() )
+        {
+            int rows = min( band_rows, height - band * band_rows );
+            boost::interprocess::mapped_region* region = new boost::interprocess::mapped_region(
+                *file, boost::interprocess::read_only,
+                (boost::interprocess::offset_t)( data_offset + rowbytes * band * band_rows ),
+                rowbytes * rows );
+            it = bands.insert( make_pair( band, region ) ).first;
+            bytes += region->get_size();
+        }
+        else
+        {
+            lru.remove( band );
+        }
+        lru.push_front( band );
+        // unmap least recently used bands, keeping the current one
+        while( bytes > budget && lru.size() > 1 )
+        {
+            map<int, boost::interprocess::mapped_region*>::iterator victim = bands.find( lru.back() );
+            bytes -= victim->second->get_size();
+            delete victim->second;
+            bands.erase( victim );
+            lru.pop_back();
+        }
+        last_band = band;
+        last_base = (const uchar*)it->second->get_address();
+        return last_base + rowbytes * ( y - band * band_rows );
+    }
+
+    int width;
+    int height;
+    int channels;
+    size_t budget;
+    int band_rows;
+    size_t data_offset;     /**< bytes of the header */
+    size_t bytes;           /**< bytes mapped */
+    boost::interprocess::file_mapping* file;
+    map<int, boost::interprocess::mapped_region*> bands;
+    list<int> lru;          /**< mapped bands, most recently used first */
+    int last_band;          /**< band of the last row() */
+    const uchar* last_base;
+};
+
+#endif
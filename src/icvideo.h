@@ -0,0 +1,224 @@
+/** @file
+*
+* Image clipper video reader with a persistent seek index
+*
+* The MIT License
+*
+* Copyright (c) 2008, Naotoshi Seo <sonots(at)umd.edu>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#ifndef IC_VIDEO_INCLUDED
+#define IC_VIDEO_INCLUDED
+
+#include "cv.h"
+#include "cxcore.h"
+#include "highgui.h"
+#include <stdio.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <map>
+#include "filesystem.h"
+#include "iccache.h"
+using namespace std;
+
+/**
+* Read video frames at random positions
+*
+* The video is split into blocks of interval frames. The first frame of
+* each block is a checkpoint whose timestamp is recorded while frames are
+* decoded sequentially, and the checkpoints and the number of frames are
+* persisted to <video>.icindex so that later runs seek to them exactly.
+* Only positions reached by decoding from frame 1 or from a checkpoint
+* are known exactly, and only they are recorded: a block without a
+* checkpoint is reached by seeking to its frame number, which lands on a
+* keyframe with some codecs, and the number of frames is learned only
+* when the end is reached from a known position and the video does not
+* claim more frames.
+*
+* A frame not in the image cache is reached by seeking to the checkpoint
+* of its block and decoding forward. Every frame decoded on the way goes
+* into the cache, so stepping backward within a block, or back and forth,
+* costs no decoding.
+*
+* Frame numbers start at 1. Frames returned are owned by the cache.
+*/
+class IcVideoReader {
+public:
+    /**
+    * @param path             The video filename
+    * @param cache            The image cache. Must outlive the reader.
+    * @param [interval = 32]  The number of frames per block
+    */
+    IcVideoReader( const string& path, IcImageCache* cache, int interval = 32 )
+        : path( path ), index_path( path + ".icindex" ), cache( cache ),
+          interval( max( 1, interval ) ), next( 1 ), exact( true ), nframes( 0 ), dirty( false )
+    {
+        cap = cvCaptureFromFile( path.c_str() );
+        load_index();
+    }
+
+    ~IcVideoReader()
+    {
+        if( dirty ) save_index();
+        if( cap != NULL ) cvReleaseCapture( &cap );
+    }
+
+    bool opened() const
+    {
+        return cap != NULL;
+    }
+
+    /**
+    * @return The number of frames. Exact if the end has ever been reached.
+    */
+    int frame_count()
+    {
+        return nframes > 0 ? nframes : (int)cvGetCaptureProperty( cap, CV_CAP_PROP_FRAME_COUNT );
+    }
+
+    /**
+    * Get a frame and pin it in the cache
+    *
+    * @param frame  The frame number
+    * @return The frame, or NULL if out of the video
+    */
+    IplImage* get( int frame )
+    {
+        if( frame < 1 || ( nframes > 0 && frame > nframes ) ) return NULL;
+        IplImage* img;
+        if( cache->acquire( key( frame ), img ) ) return img;
+
+        if( frame < next || frame > next + interval ) seek( frame );
+        while( next < frame )
+        {
+            if( decode( false ) == NULL ) return NULL;
+        }
+        return decode( true );
+    }
+
+private:
+    string key( int frame ) const
+    {
+        char buf[32];
+        sprintf( buf, "#%d", frame );
+        return path + buf;
+    }
+
+    /** Seek to the checkpoint of the block of a frame */
+    void seek( int frame )
+    {
+        int block = ( frame - 1 ) / interval;
+        map<int, double>::iterator it = checkpoints.find( block );
+        if( it != checkpoints.end() )
+        {
+            cvSetCaptureProperty( cap, CV_CAP_PROP_POS_MSEC, it->second );
+            exact = true;
+        }
+        else
+        {
+            cvSetCaptureProperty( cap, CV_CAP_PROP_POS_FRAMES, block * interval );
+            exact = false;
+        }
+        next = block * interval + 1;
+    }
+
+    /** Decode the next frame into the cache */
+    IplImage* decode( bool pin )
+    {
+        IplImage* tmpimg = cvQueryFrame( cap );
+        if( tmpimg == NULL )
+        {
+            // not a broken frame in the middle, nor an end reached by a guess
+            if( exact && nframes != next - 1 &&
+                cvGetCaptureProperty( cap, CV_CAP_PROP_FRAME_COUNT ) <= next - 1 )
+            {
+                nframes = next - 1;
+                dirty = true;
+            }
+            return NULL;
+        }
+        if( exact && ( next - 1 ) % interval == 0 &&
+            checkpoints.find( ( next - 1 ) / interval ) == checkpoints.end() )
+        {
+            checkpoints[( next - 1 ) / interval] = cvGetCaptureProperty( cap, CV_CAP_PROP_POS_MSEC );
+            dirty = true;
+        }
+        IplImage* img = cvCloneImage( tmpimg );
+#if (defined(WIN32) || defined(WIN64)) && (CV_MAJOR_VERSION < 1 || (CV_MAJOR_VERSION == 1 && CV_MINOR_VERSION < 1))
+        img->origin = 0;
+        cvFlip( img );
+#endif
+        return cache->insert( key( next++ ), img, pin );
+    }
+
+    /** The index is valid while the video size and mtime do not change */
+    string signature() const
+    {
+        ostringstream oss;
+        oss << filesystem::filesize( path ) << " " << filesystem::mtime( path ) << " " << interval;
+        return oss.str();
+    }
+
+    void load_index()
+    {
+        ifstream ifs( index_path.c_str() );
+        if( !ifs ) return;
+        string line;
+        if( !getline( ifs, line ) || line != "# imageclipper video index 2" ) return;
+        if( !getline( ifs, line ) || line != signature() ) return;
+        ifs >> nframes;
+        int block;
+        double msec;
+        while( ifs >> block >> msec )
+        {
+            checkpoints[block] = msec;
+        }
+    }
+
+    void save_index()
+    {
+        ofstream ofs( index_path.c_str() );
+        if( !ofs ) return; // e.g., read-only directory. just go without.
+        ofs.precision( 17 );
+        ofs << "# imageclipper video index 2" << endl;
+        ofs << signature() << endl;
+        ofs << nframes << endl;
+        for( map<int, double>::iterator it = checkpoints.begin(); it != checkpoints.end(); ++it )
+        {
+            ofs << it->first << " " << it->second << endl;
+        }
+    }
+
+    string path;
+    string index_path;
+    IcImageCache* cache;
+    CvCapture* cap;
+    int interval;                  /**< frames per block */
+    int next;                      /**< frame number cvQueryFrame returns next */
+    bool exact;                    /**< next is known, not guessed by a seek to a frame number */
+    int nframes;                   /**< number of frames, 0 if unknown */
+    map<int, double> checkpoints;  /**< block => timestamp (msec) of its first frame */
+    bool dirty;                    /**< index has to be saved */
+};
+
+#endif
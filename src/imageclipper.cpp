@@ -43,6 +43,17 @@
 #include "filesystem.h"
 #include "icformat.h"
 #include "cvdrawwatershed.h"
+#include "icbatch.h"
+#include "icprefetch.h"
+#include "icvideo.h"
+#include "icsave.h"
+#include "icdisplay.h"
+#include "icindex.h"
+#include "ichaartraining.h"
+#include "icjournal.h"
+#include "icsession.h"
+#include "icshard.h"
+#include "icraw.h"
 #include "opencvx/cvrect32f.h"
 #include "opencvx/cvdrawrectangle.h"
 #include "opencvx/cvcropimageroi.h"
@@ -60,8 +71,10 @@ typedef struct CvCallbackParam {
     IplImage* img;             /**< image to be shown */
     // config
     vector<string> imtypes;    /**< image file types */
+    filesystem::extension_set imset; /**< imtypes compiled once */
     const char* output_format; /**< output filename format */
     int inc;                   /**< incremental speed via keyboard operations */
+    int preview;               /**< max width and height of the sub window, 0 for full size */
     // rectangle region 
     CvRect rect;               /**< rectangle parameter to be shown */
     int rotate;                /**< rotation angle */
@@ -70,9 +83,18 @@ typedef struct CvCallbackParam {
     CvRect circle;             /**< x,y as center, width as radius */
     bool watershed;            /**< watershed flag */
     // filelist iterators
-    vector<string> filelist;            /**< directory reading */
-    vector<string>::iterator fileiter;  /**< iterator */
-    CvCapture* cap;                     /**< video reading */
+    vector<filesystem::file_entry> filelist;            /**< directory reading */
+    vector<filesystem::file_entry>::iterator fileiter;  /**< iterator */
+    IcImageCache* cache;                /**< decoded images */
+    IcPrefetcher* prefetcher;           /**< decodes images around fileiter */
+    IcVideoReader* video;               /**< video reading */
+    IcSaveQueue* saver;                 /**< writes clipped images */
+    IcImageSink* sink;                  /**< destination of clipped images other than files */
+    IcDisplay* display;                 /**< main window buffer */
+    IcTiledImage* tiled;                /**< memory mapped image shown instead of img */
+    size_t tiled_bytes;                 /**< images larger than this are mapped */
+    IcHaarTrainingWriter* positives;    /**< regions saved for --haartraining */
+    IcJournal* journal;                 /**< journal of regions saved */
     int frame;                          /**< iterator */
 } CvCallbackParam ;
 
@@ -86,6 +108,23 @@ typedef struct ArgParam {
     const char* vidout_format;
     const char* output_format;
     int   frame;
+    const char* batch;
+    int   threads;
+    int   prefetch;
+    int   cache_mb;
+    int   save_queue;
+    int   preview;
+    CvSize view;
+    int   tiled_mb;
+    string index;
+    bool  recursive;
+    const char* haartraining;
+    const char* collect;
+    const char* journal;
+    const char* dump_journal;
+    const char* session;
+    int   shard_mb;
+    CvSize raw_size;
 } ArgParam;
 
 /************************* Function Prototypes ******************************/
@@ -94,7 +133,15 @@ void usage( const ArgParam* arg );
 void gui_usage();
 void mouse_callback( int event, int x, int y, int flags, void* _param );
 void load_reference( const ArgParam* arg, CvCallbackParam* param );
+void load_image( CvCallbackParam* param );
+void save_session( const ArgParam* arg, CvCallbackParam* param );
+void record_saved( IcHaarTrainingWriter* positives, IcJournal* journal, const string& source,
+                   const string& output, int frame, CvRect rect, int rotate, CvPoint shear );
+IcImageSink* create_sink( const ArgParam* arg, const char** output_format );
 void key_callback( const ArgParam* arg, CvCallbackParam* param );
+int  batch_clip( const ArgParam* arg, CvCallbackParam* param );
+int  collect_clipped( const ArgParam* arg, CvCallbackParam* param );
+int  write_haartraining( const string& path, const IcHaarTrainingWriter& positives );
 
 /************************* Main **********************************************/
 
@@ -106,15 +153,26 @@ int main( int argc, char *argv[] )
         "Cropped",
         NULL,
         vector<string>(),
+        filesystem::extension_set(),
         NULL,
         1,
+        640,
         cvRect(0,0,0,0),
         0,
         cvPoint(0,0),
         cvRect(0,0,0,0),
         false,
-        vector<string>(),
-        vector<string>::iterator(),
+        vector<filesystem::file_entry>(),
+        vector<filesystem::file_entry>::iterator(),
+        NULL,
+        NULL,
+        NULL,
+        NULL,
+        NULL,
+        NULL,
+        NULL,
+        0,
+        NULL,
         NULL,
         0
     };
@@ -125,13 +183,14 @@ int main( int argc, char *argv[] )
     init_param.imtypes.push_back( "jpe" );
     init_param.imtypes.push_back( "png" );
     init_param.imtypes.push_back( "pbm" );
-    init_param.imtypes.push_back( "pbm" );
+    init_param.imtypes.push_back( "pgm" );
     init_param.imtypes.push_back( "ppm" );
     init_param.imtypes.push_back( "sr" );
     init_param.imtypes.push_back( "ras" );
     init_param.imtypes.push_back( "tiff" );
     init_param.imtypes.push_back( "exr" );
     init_param.imtypes.push_back( "jp2" );
+    init_param.imset = filesystem::extension_set( init_param.imtypes );
     CvCallbackParam* param = &init_param;
 
     ArgParam init_arg = {
@@ -140,12 +199,50 @@ int main( int argc, char *argv[] )
         "%d/imageclipper/%i.%e_%04r_%04x_%04y_%04w_%04h.png",
         "%d/imageclipper/%i.%e_%04f_%04r_%04x_%04y_%04w_%04h.png",
         NULL,
-        1
+        1,
+        NULL,
+        0,
+        2,
+        512,
+        8,
+        640,
+        cvSize(1280,960),
+        256,
+        "",
+        false,
+        NULL,
+        NULL,
+        NULL,
+        NULL,
+        NULL,
+        1024,
+        cvSize(64,64)
     };
     ArgParam *arg = &init_arg;
 
     // parse arguments
     arg_parse( argc, argv, arg );
+    if( arg->dump_journal != NULL )
+    {
+        if( IcJournal::dump( arg->dump_journal, cout ) ) return 0;
+        cerr << "The journal " << arg->dump_journal << " is not readable." << endl;
+        return 1;
+    }
+    if( arg->collect != NULL )
+    {
+        return collect_clipped( arg, param );
+    }
+    if( arg->journal != NULL )
+    {
+        param->journal = new IcJournal( arg->journal );
+        if( !param->journal->opened() ) exit(1);
+    }
+    if( arg->batch != NULL )
+    {
+        int ret = batch_clip( arg, param );
+        delete param->journal;
+        return ret;
+    }
     gui_usage();
     load_reference( arg, param );
 
@@ -153,9 +250,31 @@ int main( int argc, char *argv[] )
     cvNamedWindow( param->w_name, CV_WINDOW_AUTOSIZE );
     cvNamedWindow( param->miniw_name, CV_WINDOW_AUTOSIZE );
     cvSetMouseCallback( param->w_name, mouse_callback, param );
+    param->sink = create_sink( arg, &param->output_format );
+    param->saver = new IcSaveQueue( arg->save_queue, param->sink );
+    param->display = new IcDisplay( param->w_name, arg->view );
+    if( arg->haartraining != NULL ) param->positives = new IcHaarTrainingWriter();
     key_callback( arg, param );
+    delete param->saver; // flush
+    delete param->sink;
+    if( param->positives != NULL )
+    {
+        write_haartraining( arg->haartraining, *param->positives );
+        delete param->positives;
+    }
+    delete param->journal;
+    param->display->print_stats( cerr );
+    delete param->display;
     cvDestroyWindow( param->w_name );
     cvDestroyWindow( param->miniw_name );
+    delete param->prefetcher;
+    delete param->video;
+    delete param->tiled;
+    if( param->cache != NULL )
+    {
+        param->cache->print_stats( cerr );
+        delete param->cache;
+    }
 }
 
 /**
@@ -164,18 +283,33 @@ int main( int argc, char *argv[] )
 void load_reference( const ArgParam* arg, CvCallbackParam* param )
 {
     bool is_dir   = filesystem::is_dir( arg->reference );
-    bool is_image = filesystem::match_extensions( arg->reference, param->imtypes );
+    bool is_image = filesystem::match_extensions( arg->reference, param->imset );
     bool is_video = !is_dir & !is_image;
     param->output_format = ( arg->output_format != NULL ? arg->output_format : 
         ( is_video ? arg->vidout_format : arg->imgout_format ) );
     param->frame = arg->frame;
+    param->preview = arg->preview;
+    param->tiled_bytes = (size_t)arg->tiled_mb * 1024 * 1024;
+    param->cache = new IcImageCache( (size_t)arg->cache_mb * 1024 * 1024 );
+    IcSession session;
+    bool resume = arg->session != NULL && session.load( arg->session ) &&
+        session.reference == filesystem::canonical( arg->reference );
+    if( resume )
+    {
+        param->frame = max( 1, session.frame );
+        param->rect = session.rect;
+        param->rotate = session.rotate;
+        param->shear = session.shear;
+    }
 
     if( is_dir || is_image )
     {
         cerr << "Now reading a directory..... ";
+        string dirpath = is_dir ? arg->reference : filesystem::dirname( arg->reference );
+        IcDirectoryScan scan( param->imtypes, arg->index, is_dir && arg->recursive, arg->threads );
+        param->filelist = scan.scan( dirpath );
         if( is_dir )
         {
-            param->filelist = filesystem::filelist( arg->reference, param->imtypes, "file" );
             if( param->filelist.empty() )
             {
                 cerr << "No image file exist under a directory " << filesystem::realpath( arg->reference ) << endl << endl;
@@ -192,16 +326,39 @@ void load_reference( const ArgParam* arg, CvCallbackParam* param )
                 usage( arg );
                 exit(1);
             }
-            param->filelist = filesystem::filelist( filesystem::dirname( arg->reference ), param->imtypes, "file" );
             // step up till specified file
+            string reference = filesystem::realpath( arg->reference );
             for( param->fileiter = param->filelist.begin(); param->fileiter != param->filelist.end(); param->fileiter++ )
             {
-                if( filesystem::realpath( *param->fileiter ) == filesystem::realpath( arg->reference ) ) break;
+                if( param->fileiter->path == reference ) break;
+            }
+        }
+        if( resume )
+        {
+            // the saved file, canonical, spelled as the listing of the directory given this time
+            string root = filesystem::canonical( dirpath.empty() ? "." : dirpath );
+            string file = session.file;
+            size_t skip = root.size() + ( root[root.size() - 1] == '/' || root[root.size() - 1] == '\\' ? 0 : 1 );
+            if( file.size() > skip && file.compare( 0, root.size(), root ) == 0 )
+            {
+                file = ( boost::filesystem::path( dirpath ) / file.substr( skip ) ).native_file_string();
+            }
+            // seek to the saved index, or search the saved file if the listing changed
+            int index = session.index;
+            if( index < 0 || index >= (int)param->filelist.size() || param->filelist[index].path != file )
+            {
+                for( index = 0; index < (int)param->filelist.size(); index++ )
+                {
+                    if( param->filelist[index].path == file ) break;
+                }
             }
+            if( index < (int)param->filelist.size() ) param->fileiter = param->filelist.begin() + index;
         }
         cerr << "Done!" << endl;
-        cerr << "Now showing " << filesystem::realpath( *param->fileiter ) << endl;
-        param->img = cvLoadImage( filesystem::realpath( *param->fileiter ).c_str() );
+        scan.print_stats( cerr );
+        cerr << "Now showing " << param->fileiter->path << endl;
+        param->prefetcher = new IcPrefetcher( param->filelist, param->cache, arg->prefetch, param->tiled_bytes );
+        load_image( param );
     }
     else if( is_video )
     {
@@ -212,9 +369,8 @@ void load_reference( const ArgParam* arg, CvCallbackParam* param )
             exit(1);
         }
         cerr << "Now reading a video..... ";
-        param->cap = cvCaptureFromFile( filesystem::realpath( arg->reference ).c_str() );
-        cvSetCaptureProperty( param->cap, CV_CAP_PROP_POS_FRAMES, arg->frame - 1 );
-        param->img = cvQueryFrame( param->cap );
+        param->video = new IcVideoReader( filesystem::realpath( arg->reference ), param->cache );
+        param->img = param->video->opened() ? param->video->get( param->frame ) : NULL;
         if( param->img == NULL )
         {
             cerr << "The file " << filesystem::realpath( arg->reference ) << " was assumed as a video, but not loadable." << endl << endl;
@@ -222,12 +378,8 @@ void load_reference( const ArgParam* arg, CvCallbackParam* param )
             exit(1);
         }
         cerr << "Done!" << endl;
-        cerr << cvGetCaptureProperty( param->cap, CV_CAP_PROP_FRAME_COUNT ) << " frames totally." << endl;
-        cerr << "Now showing " << filesystem::realpath( arg->reference ) << " " << arg->frame << endl;
-#if (defined(WIN32) || defined(WIN64)) && (CV_MAJOR_VERSION < 1 || (CV_MAJOR_VERSION == 1 && CV_MINOR_VERSION < 1))
-        param->img->origin = 0;
-        cvFlip( param->img );
-#endif
+        cerr << param->video->frame_count() << " frames totally." << endl;
+        cerr << "Now showing " << filesystem::realpath( arg->reference ) << " " << param->frame << endl;
     }
     else
     {
@@ -237,17 +389,185 @@ void load_reference( const ArgParam* arg, CvCallbackParam* param )
     }
 }
 
+/**
+ * Load the image at fileiter. An image too large to decode is mapped.
+ */
+void load_image( CvCallbackParam* param )
+{
+    int index = param->fileiter - param->filelist.begin();
+    delete param->tiled;
+    param->tiled = NULL;
+    param->img = NULL;
+    if( param->tiled_bytes > 0 && IcTiledImage::is_tiled( param->fileiter->path, param->tiled_bytes ) )
+    {
+        param->tiled = new IcTiledImage( param->fileiter->path, param->tiled_bytes );
+        if( !param->tiled->opened() ) // e.g., truncated after classified, decoded instead
+        {
+            delete param->tiled;
+            param->tiled = NULL;
+        }
+    }
+    if( param->tiled != NULL )
+    {
+        param->prefetcher->move( index );
+        if( param->display != NULL ) param->display->load( param->tiled );
+    }
+    else
+    {
+        param->img = param->prefetcher->get( index );
+        if( param->display != NULL ) param->display->load( param->img );
+    }
+}
+
+/**
+ * Save the position and the rectangle to the --session file
+ */
+void save_session( const ArgParam* arg, CvCallbackParam* param )
+{
+    if( arg->session == NULL ) return;
+    IcSession session;
+    session.reference = filesystem::canonical( arg->reference );
+    if( param->video == NULL )
+    {
+        // the directory only, not to resolve a symbolic link to an image
+        const string& dirname = *param->fileiter->dirname;
+        session.file = ( boost::filesystem::path( filesystem::canonical( dirname.empty() ? "." : dirname ) ) /
+                         filesystem::basename( param->fileiter->path ) ).native_file_string();
+        session.index = (int)( param->fileiter - param->filelist.begin() );
+    }
+    session.frame = param->frame;
+    session.rect = param->rect;
+    session.rotate = param->rotate;
+    session.shear = param->shear;
+    if( !session.save( arg->session ) ) cerr << "Failed to write " << arg->session << endl;
+}
+
+/**
+ * Print a clipped image and record it to the --haartraining positives and
+ * the --journal, called by the writer thread once the image is written
+ *
+ * @param positives  NULL not to record, or for a video
+ * @param journal    NULL not to record
+ */
+void record_saved( IcHaarTrainingWriter* positives, IcJournal* journal, const string& source,
+                   const string& output, int frame, CvRect rect, int rotate, CvPoint shear )
+{
+    cout << output << endl;
+    if( positives != NULL )
+    {
+        positives->add( source, rect, rotate, shear );
+    }
+    if( journal != NULL )
+    {
+        journal->append( source, output, frame, rect, rotate, shear );
+    }
+}
+
+/**
+ * Create the sink selected by a prefix of the output format, tar: or raw:,
+ * and strip the prefix
+ *
+ * @return the sink, or NULL to write one file per image
+ */
+IcImageSink* create_sink( const ArgParam* arg, const char** output_format )
+{
+    if( !strncmp( *output_format, "tar:", 4 ) )
+    {
+        *output_format += 4;
+        return new IcTarSink( (size_t)arg->shard_mb * 1024 * 1024 );
+    }
+    if( !strncmp( *output_format, "raw:", 4 ) )
+    {
+        if( arg->raw_size.width <= 0 || arg->raw_size.height <= 0 )
+        {
+            cerr << "The --raw-size must be given as <width>x<height>." << endl << endl;
+            usage( arg );
+            exit(1);
+        }
+        *output_format += 4;
+        return new IcRawSink( arg->raw_size );
+    }
+    return NULL;
+}
+
+/**
+ * Clip regions listed in a manifest without creating windows
+ */
+int batch_clip( const ArgParam* arg, CvCallbackParam* param )
+{
+    vector<IcBatchRegion> regions;
+    if( !icReadBatchManifest( arg->batch, regions ) )
+    {
+        cerr << "The manifest file " << filesystem::realpath( arg->batch ) << " is not readable." << endl << endl;
+        usage( arg );
+        exit(1);
+    }
+    const char* output_format = ( arg->output_format != NULL ? arg->output_format : arg->imgout_format );
+    IcImageSink* sink = create_sink( arg, &output_format );
+    IcHaarTrainingWriter positives;
+    int nfailed = icClipBatch( regions, output_format, param->imtypes, arg->threads,
+                               arg->haartraining != NULL ? &positives : NULL, param->journal, sink );
+    delete sink;
+    cerr << regions.size() - nfailed << " of " << regions.size() << " regions clipped." << endl;
+    if( arg->haartraining != NULL && write_haartraining( arg->haartraining, positives ) != 0 ) return 1;
+    return nfailed > 0 ? 1 : 0;
+}
+
+/**
+ * Rebuild the haartraining file from the names of clipped images
+ */
+int collect_clipped( const ArgParam* arg, CvCallbackParam* param )
+{
+    if( !filesystem::is_dir( arg->collect ) )
+    {
+        cerr << "The directory " << filesystem::realpath( arg->collect ) << " does not exist." << endl << endl;
+        usage( arg );
+        exit(1);
+    }
+    IcHaarTrainingWriter positives;
+    IcFormat format( arg->output_format != NULL ? arg->output_format : arg->imgout_format );
+    int n = positives.collect( arg->collect, param->imset, format );
+    cerr << n << " clipped images collected." << endl;
+    return write_haartraining( arg->haartraining != NULL ? arg->haartraining : "-", positives );
+}
+
+/**
+ * Write regions in the OpenCV haartraining format
+ */
+int write_haartraining( const string& path, const IcHaarTrainingWriter& positives )
+{
+    if( !positives.write( path ) )
+    {
+        cerr << "Failed to write " << path << endl;
+        return 1;
+    }
+    if( path != "-" ) cerr << positives.size() << " regions written to " << path << endl;
+    if( positives.skipped() > 0 )
+    {
+        cerr << positives.skipped() << " rotated or sheared regions skipped, which haartraining does not take." << endl;
+    }
+    return 0;
+}
+
 /**
  * Keyboard operations
  */
 void key_callback( const ArgParam* arg, CvCallbackParam* param )
 {
-    string filename = param->cap == NULL ? *param->fileiter : arg->reference;
+    // decomposed once, not on every save
+    filesystem::file_entry video_entry;
+    if( param->video != NULL ) video_entry = filesystem::decompose( arg->reference );
+    const filesystem::file_entry* entry = param->video == NULL ? &*param->fileiter : &video_entry;
+    IcFormat output_format( param->output_format );
 
-    cvShowCroppedImage( param->miniw_name, param->img, 
+    if( param->tiled != NULL )
+        param->display->load( param->tiled );
+    else
+        param->display->load( param->img );
+    param->display->show_cropped( param->miniw_name, 
         cvRect32fFromRect( param->rect, param->rotate ), 
-        cvPointTo32f( param->shear ) );
-    cvShowImageAndRectangle( param->w_name, param->img, 
+        cvPointTo32f( param->shear ), param->preview );
+    param->display->show_rectangle( 
         cvRect32fFromRect( param->rect, param->rotate ), 
         cvPointTo32f( param->shear ) );
 
@@ -260,93 +580,96 @@ void key_callback( const ArgParam* arg, CvCallbackParam* param )
         {
             if( param->rect.width > 0 && param->rect.height > 0 )
             {
-                string output_path = icFormat( 
-                    param->output_format, filesystem::dirname( filename ), 
-                    filesystem::filename( filename ), filesystem::extension( filename ),
+                string output_path = output_format( 
+                    *entry->dirname, entry->stem, entry->extension,
                     param->rect.x, param->rect.y, param->rect.width, param->rect.height, 
                     param->frame, param->rotate );
 
-                if( !filesystem::match_extensions( output_path, param->imtypes ) )
+                if( !filesystem::match_extensions( output_path, param->imset ) )
                 {
                     cerr << "The image type " << filesystem::extension( output_path ) << " is not supported." << endl;
+                    param->saver->flush();
                     exit(1);
                 }
-                filesystem::r_mkdir( filesystem::dirname( output_path ) );
 
-                IplImage* crop = cvCreateImage( 
-                    cvSize( param->rect.width, param->rect.height ), 
-                    param->img->depth, param->img->nChannels );
-                cvCropImageROI( param->img, crop, 
-                                cvRect32fFromRect( param->rect, param->rotate ), 
-                                cvPointTo32f( param->shear ) );
-                cvSaveImage( filesystem::realpath( output_path ).c_str(), crop );
-                cout << filesystem::realpath( output_path ) << endl;
-                cvReleaseImage( &crop );
+                IplImage* crop = param->display->crop( 
+                    cvRect32fFromRect( param->rect, param->rotate ), 
+                    cvPointTo32f( param->shear ) );
+                if( crop == NULL )
+                {
+                    cerr << "No image is loaded to be clipped. Not saved." << endl;
+                }
+                else
+                {
+                    output_path = filesystem::realpath( output_path );
+                    // printed and recorded only after the image is written
+                    param->saver->push( output_path, crop,
+                                        boost::bind( &record_saved, param->video == NULL ? param->positives : NULL,
+                                                     param->journal, entry->path, output_path,
+                                                     param->video != NULL ? param->frame : 0,
+                                                     param->rect, param->rotate, param->shear ) );
+                    save_session( arg, param );
+                }
             }
         }
         // Forward
         if( key == 'f' || key == 32 ) // 32 is SPACE
         {
-            if( param->cap )
+            if( param->video )
             {
-                IplImage* tmpimg = cvQueryFrame( param->cap );
+                IplImage* tmpimg = param->video->get( param->frame + 1 );
                 if( tmpimg != NULL )
-                //if( frame < cvGetCaptureProperty( param->cap, CV_CAP_PROP_FRAME_COUNT ) )
                 {
                     param->img = tmpimg; 
-#if (defined(WIN32) || defined(WIN64)) && (CV_MAJOR_VERSION < 1 || (CV_MAJOR_VERSION == 1 && CV_MINOR_VERSION < 1))
-                    param->img->origin = 0;
-                    cvFlip( param->img );
-#endif
+                    param->display->load( param->img );
                     param->frame++;
-                    cout << "Now showing " << filesystem::realpath( filename ) << " " <<  param->frame << endl;
+                    cout << "Now showing " << entry->path << " " <<  param->frame << endl;
+                    save_session( arg, param );
                 }
             }
             else
             {
                 if( param->fileiter + 1 != param->filelist.end() )
                 {
-                    cvReleaseImage( &param->img );
                     param->fileiter++;
-                    filename = *param->fileiter;
-                    param->img = cvLoadImage( filesystem::realpath( filename ).c_str() );
-                    cout << "Now showing " << filesystem::realpath( filename ) << endl;
+                    entry = &*param->fileiter;
+                    load_image( param );
+                    cout << "Now showing " << entry->path << endl;
+                    save_session( arg, param );
                 }
             }
         }
         // Backward
         else if( key == 'b' )
         {
-            if( param->cap )
+            if( param->video )
             {
                 IplImage* tmpimg;
                 param->frame = max( 1, param->frame - 1 );
-                cvSetCaptureProperty( param->cap, CV_CAP_PROP_POS_FRAMES, param->frame - 1 );
-                if( tmpimg = cvQueryFrame( param->cap ) )
+                if( tmpimg = param->video->get( param->frame ) )
                 {
                     param->img = tmpimg;
-#if (defined(WIN32) || defined(WIN64)) && (CV_MAJOR_VERSION < 1 || (CV_MAJOR_VERSION == 1 && CV_MINOR_VERSION < 1))
-                    param->img->origin = 0;
-                    cvFlip( param->img );
-#endif
-                    cout << "Now showing " << filesystem::realpath( filename ) << " " <<  param->frame << endl;
+                    param->display->load( param->img );
+                    cout << "Now showing " << entry->path << " " <<  param->frame << endl;
+                    save_session( arg, param );
                 }
             }
             else
             {
                 if( param->fileiter != param->filelist.begin() ) 
                 {
-                    cvReleaseImage( &param->img );
                     param->fileiter--;
-                    filename = *param->fileiter;
-                    param->img = cvLoadImage( filesystem::realpath( filename ).c_str() );
-                    cout << "Now showing " << filesystem::realpath( filename ) << endl;
+                    entry = &*param->fileiter;
+                    load_image( param );
+                    cout << "Now showing " << entry->path << endl;
+                    save_session( arg, param );
                 }
             }
         }
         // Exit
         else if( key == 'q' || key == 27 ) // 27 is ESC
         {
+            save_session( arg, param );
             break;
         }
         else if( key == '+' )
@@ -359,6 +682,31 @@ void key_callback( const ArgParam* arg, CvCallbackParam* param )
             param->inc = max( 1, param->inc - 1 );
             cout << "Inc: " << param->inc << endl;
         }
+        // View
+        else if( key == 'z' ) // Zoom in
+        {
+            param->display->zoom( 1 );
+        }
+        else if( key == 'Z' ) // Zoom out
+        {
+            param->display->zoom( -1 );
+        }
+        else if( key == 'H' ) // Pan left
+        {
+            param->display->pan( -0.25, 0 );
+        }
+        else if( key == 'J' ) // Pan down
+        {
+            param->display->pan( 0, 0.25 );
+        }
+        else if( key == 'K' ) // Pan up
+        {
+            param->display->pan( 0, -0.25 );
+        }
+        else if( key == 'L' ) // Pan right
+        {
+            param->display->pan( 0.25, 0 );
+        }
 
         if( param->watershed ) // watershed
         {
@@ -433,12 +781,12 @@ void key_callback( const ArgParam* arg, CvCallbackParam* param )
                 param->circle.width -= param->inc;
             }
 
-            if( param->img )
+            if( param->display->loaded() )
             {
-                param->rect = cvShowImageAndWatershed( param->w_name, param->img, param->circle );
-                cvShowCroppedImage( param->miniw_name, param->img, 
+                param->rect = param->display->show_watershed( param->circle );
+                param->display->show_cropped( param->miniw_name, 
                                     cvRect32fFromRect( param->rect, param->rotate ), 
-                                    cvPointTo32f( param->shear ) );
+                                    cvPointTo32f( param->shear ), param->preview );
             }
         }
         else
@@ -514,9 +862,9 @@ void key_callback( const ArgParam* arg, CvCallbackParam* param )
             }
             else if( key == 'E' ) // Shrink
             {
-                param->rect.x = min( param->img->width, param->rect.x + param->inc );
+                param->rect.x = min( param->display->image_size().width, param->rect.x + param->inc );
                 param->rect.width = max( 0, param->rect.width - 2 * param->inc );
-                param->rect.y = min( param->img->height, param->rect.y + param->inc );
+                param->rect.y = min( param->display->image_size().height, param->rect.y + param->inc );
                 param->rect.height = max( 0, param->rect.height - 2 * param->inc );
             }
             /*
@@ -541,21 +889,21 @@ void key_callback( const ArgParam* arg, CvCallbackParam* param )
               cout << ratio_width << ":" << ratio_height << " * " << gcd << endl;
               param->rect.width = ratio_width * gcd;
               param->rect.height = ratio_height * gcd; 
-              cvShowImageAndRectangle( param->w_name, param->img, 
+              param->display->show_rectangle( 
               cvRect32fFromRect( param->rect, param->rotate ), 
               cvPointTo32f( param->shear ) );
               }
               }
               }*/
 
-            if( param->img )
+            if( param->display->loaded() )
             {
-                cvShowImageAndRectangle( param->w_name, param->img, 
+                param->display->show_rectangle( 
                                          cvRect32fFromRect( param->rect, param->rotate ), 
                                          cvPointTo32f( param->shear ) );
-                cvShowCroppedImage( param->miniw_name, param->img, 
+                param->display->show_cropped( param->miniw_name, 
                                     cvRect32fFromRect( param->rect, param->rotate ), 
-                                    cvPointTo32f( param->shear ) );
+                                    cvPointTo32f( param->shear ), param->preview );
             }
         }
     }
@@ -576,11 +924,14 @@ void mouse_callback( int event, int x, int y, int flags, void* _param )
     static bool move_watershed     = false;
     static bool resize_watershed   = false;
 
-    if( !param->img )
+    if( !param->display->loaded() )
         return;
 
     if( x >= 32768 ) x -= 65536; // change left outsite to negative
     if( y >= 32768 ) y -= 65536; // change top outside to negative
+    CvPoint pt = param->display->to_image( cvPoint( x, y ) ); // window to image coordinates
+    x = pt.x;
+    y = pt.y;
 
     // MBUTTON or LBUTTON + SHIFT is to draw wathershed
     if( event == CV_EVENT_MBUTTONDOWN || 
@@ -597,10 +948,10 @@ void mouse_callback( int event, int x, int y, int flags, void* _param )
         param->shear.x = param->shear.y = 0;
 
         param->circle.width = (int) cvPointNorm( cvPoint( param->circle.x, param->circle.y ), cvPoint( x, y ) );
-        param->rect = cvShowImageAndWatershed( param->w_name, param->img, param->circle );
-        cvShowCroppedImage( param->miniw_name, param->img, 
+        param->rect = param->display->show_watershed( param->circle );
+        param->display->show_cropped( param->miniw_name, 
                             cvRect32fFromRect( param->rect, param->rotate ), 
-                            cvPointTo32f( param->shear ) );
+                            cvPointTo32f( param->shear ), param->preview );
     }
 
     // LBUTTON is to draw rectangle
@@ -619,12 +970,12 @@ void mouse_callback( int event, int x, int y, int flags, void* _param )
         param->rect.width =  abs( point0.x - x );
         param->rect.height = abs( point0.y - y );
 
-        cvShowImageAndRectangle( param->w_name, param->img, 
+        param->display->show_rectangle( 
                                  cvRect32fFromRect( param->rect, param->rotate ), 
                                  cvPointTo32f( param->shear ) );
-        cvShowCroppedImage( param->miniw_name, param->img, 
+        param->display->show_cropped( param->miniw_name, 
                             cvRect32fFromRect( param->rect, param->rotate ), 
-                            cvPointTo32f( param->shear ) );
+                            cvPointTo32f( param->shear ), param->preview );
     }
 
     // RBUTTON to move rentangle or watershed marker
@@ -680,20 +1031,20 @@ void mouse_callback( int event, int x, int y, int flags, void* _param )
             param->circle.x += move.x;
             param->circle.y += move.y;
 
-            param->rect = cvShowImageAndWatershed( param->w_name, param->img, param->circle );
-            cvShowCroppedImage( param->miniw_name, param->img, 
+            param->rect = param->display->show_watershed( param->circle );
+            param->display->show_cropped( param->miniw_name, 
                                 cvRect32fFromRect( param->rect, param->rotate ),
-                                cvPointTo32f( param->shear ) );
+                                cvPointTo32f( param->shear ), param->preview );
 
             point0 = cvPoint( x, y );
         }
         else if( resize_watershed )
         {
             param->circle.width = (int) cvPointNorm( cvPoint( param->circle.x, param->circle.y ), cvPoint( x, y ) );
-            param->rect = cvShowImageAndWatershed( param->w_name, param->img, param->circle );
-            cvShowCroppedImage( param->miniw_name, param->img, 
+            param->rect = param->display->show_watershed( param->circle );
+            param->display->show_cropped( param->miniw_name, 
                                 cvRect32fFromRect( param->rect, param->rotate ), 
-                                cvPointTo32f( param->shear ) );
+                                cvPointTo32f( param->shear ), param->preview );
         }
     }
     else if( event == CV_EVENT_MOUSEMOVE && flags & CV_EVENT_FLAG_RBUTTON ) // Move or resize for rectangle
@@ -746,12 +1097,12 @@ void mouse_callback( int event, int x, int y, int flags, void* _param )
             resize_rect_bottom = tmp;
         }
 
-        cvShowImageAndRectangle( param->w_name, param->img, 
+        param->display->show_rectangle( 
                                  cvRect32fFromRect( param->rect, param->rotate ), 
                                  cvPointTo32f( param->shear ) );
-        cvShowCroppedImage( param->miniw_name, param->img, 
+        param->display->show_cropped( param->miniw_name, 
                             cvRect32fFromRect( param->rect, param->rotate ), 
-                            cvPointTo32f( param->shear ) );
+                            cvPointTo32f( param->shear ), param->preview );
         point0 = cvPoint( x, y );
     }
 
@@ -797,6 +1148,76 @@ void arg_parse( int argc, char** argv, ArgParam *arg )
         {
             arg->frame = atoi( argv[++i] );
         }
+        else if( !strcmp( argv[i], "--haartraining" ) )
+        {
+            arg->haartraining = argv[++i];
+        }
+        else if( !strcmp( argv[i], "--collect" ) )
+        {
+            arg->collect = argv[++i];
+        }
+        else if( !strcmp( argv[i], "--journal" ) )
+        {
+            arg->journal = argv[++i];
+        }
+        else if( !strcmp( argv[i], "--dump-journal" ) )
+        {
+            arg->dump_journal = argv[++i];
+        }
+        else if( !strcmp( argv[i], "--session" ) )
+        {
+            arg->session = argv[++i];
+        }
+        else if( !strcmp( argv[i], "--shard-mb" ) )
+        {
+            arg->shard_mb = atoi( argv[++i] );
+        }
+        else if( !strcmp( argv[i], "--raw-size" ) )
+        {
+            arg->raw_size = cvSize( 0, 0 );
+            sscanf( argv[++i], "%dx%d", &arg->raw_size.width, &arg->raw_size.height );
+        }
+        else if( !strcmp( argv[i], "--batch" ) )
+        {
+            arg->batch = argv[++i];
+        }
+        else if( !strcmp( argv[i], "--threads" ) )
+        {
+            arg->threads = atoi( argv[++i] );
+        }
+        else if( !strcmp( argv[i], "--prefetch" ) )
+        {
+            arg->prefetch = atoi( argv[++i] );
+        }
+        else if( !strcmp( argv[i], "--cache-mb" ) )
+        {
+            arg->cache_mb = atoi( argv[++i] );
+        }
+        else if( !strcmp( argv[i], "--save-queue" ) )
+        {
+            arg->save_queue = atoi( argv[++i] );
+        }
+        else if( !strcmp( argv[i], "--preview" ) )
+        {
+            arg->preview = atoi( argv[++i] );
+        }
+        else if( !strcmp( argv[i], "--tiled-mb" ) )
+        {
+            arg->tiled_mb = atoi( argv[++i] );
+        }
+        else if( !strcmp( argv[i], "--index" ) )
+        {
+            arg->index = string( argv[++i] );
+        }
+        else if( !strcmp( argv[i], "-r" ) || !strcmp( argv[i], "--recursive" ) )
+        {
+            arg->recursive = true;
+        }
+        else if( !strcmp( argv[i], "--view" ) )
+        {
+            arg->view = cvSize( 0, 0 );
+            sscanf( argv[++i], "%dx%d", &arg->view.width, &arg->view.height );
+        }
         else
         {
             arg->reference = string( argv[i] );
@@ -837,6 +1258,15 @@ void usage( const ArgParam* arg )
     cout << "            %f - frame number (for video)" << endl;
     cout << "        Example) ./$i_%04x_%04y_%04w_%04h.%e" << endl;
     cout << "            Store into software directory and use image type of the original." << endl;
+    cout << "        Prefix tar: to append images to tar shards instead of one file per image." << endl;
+    cout << "        The directory of a path names the shards and the filename the member, e.g.," << endl;
+    cout << "        tar:%d/imageclipper/%i_%04x_%04y_%04w_%04h.png appends to" << endl;
+    cout << "        %d/imageclipper-00000.tar, -00001.tar, ... (see --shard-mb)" << endl;
+    cout << "        Prefix raw: to append images resized to --raw-size as uint8 RGB pixels to one" << endl;
+    cout << "        raw tensor file, e.g., raw:%d/imageclipper/%i_%04x_%04y_%04w_%04h.png appends" << endl;
+    cout << "        to %d/imageclipper.raw (a 64 byte header of the shape, then the images) and" << endl;
+    cout << "        the filenames to %d/imageclipper.raw.names. Images must be 8-bit, and an" << endl;
+    cout << "        existing file is appended to only if its header matches in every field." << endl;
     cout << "    -i <imgout_format = " << arg->imgout_format << ">" << endl;
     cout << "        Determine the output file path format for image inputs." << endl;
     cout << "    -v <vidout_format = " << arg->vidout_format << ">" << endl;
@@ -844,6 +1274,59 @@ void usage( const ArgParam* arg )
     cout << "    -f" << endl;
     cout << "    --frame <frame = 1> (video)" << endl;
     cout << "        Determine the frame number of video to start to read." << endl;
+    cout << "    --prefetch <prefetch = 2> (directory)" << endl;
+    cout << "        Determine the number of images to decode ahead and behind in background." << endl;
+    cout << "    --cache-mb <cache_mb = 512>" << endl;
+    cout << "        Determine the memory budget in MB to keep decoded images for navigation." << endl;
+    cout << "    --save-queue <save_queue = 8>" << endl;
+    cout << "        Determine the number of clipped images which may wait to be written in background." << endl;
+    cout << "    --preview <preview = 640>" << endl;
+    cout << "        Determine the maximum width and height of the Cropped window." << endl;
+    cout << "        A larger region is shown shrunk. Saved images are always in full size. 0 for no limit." << endl;
+    cout << "    --view <view = 1280x960>" << endl;
+    cout << "        Determine the maximum size of the main window. A larger image is shown" << endl;
+    cout << "        shrunk by a power of 2 and may be zoomed and panned. 0x0 for no limit." << endl;
+    cout << "    --tiled-mb <tiled_mb = 256> (directory)" << endl;
+    cout << "        Binary PNM images (P5, P6) larger than tiled_mb MB are memory mapped instead" << endl;
+    cout << "        of decoded, keeping at most tiled_mb MB of them mapped. 0 to decode always." << endl;
+    cout << "    --index <index = \"\"> (directory)" << endl;
+    cout << "        Determine the index file which keeps the image file list of the directory to" << endl;
+    cout << "        start up quickly, e.g., .imageclipper.index. A bare file name is put in the" << endl;
+    cout << "        directory (and in every subdirectory with -r), a path is used for the directory" << endl;
+    cout << "        only. No index by default." << endl;
+    cout << "    -r" << endl;
+    cout << "    --recursive (directory)" << endl;
+    cout << "        Read image files in subdirectories too. Directories are read in parallel" << endl;
+    cout << "        by threads. Files are shown in natural order, e.g., 2.png before 10.png." << endl;
+    cout << "    --batch <manifest>" << endl;
+    cout << "        Clip regions listed in the manifest without GUI, and exit." << endl;
+    cout << "        Each line is \"filename x y width height [rotation [shear_x shear_y]]\"." << endl;
+    cout << "        Output file paths are determined by -o or -i." << endl;
+    cout << "    --threads <threads = number of cores> (batch, recursive)" << endl;
+    cout << "        Determine the number of worker threads for --batch and --recursive." << endl;
+    cout << "    --haartraining <info> (directory, batch)" << endl;
+    cout << "        Write the regions saved to info at exit in the OpenCV haartraining format," << endl;
+    cout << "        \"image count x y width height ...\" grouped by image. - for stdout. Images are" << endl;
+    cout << "        named by their filenames without directories, e.g., lena.png, as --collect" << endl;
+    cout << "        and haartrainingformat.pl --basename name them." << endl;
+    cout << "    --collect <directory>" << endl;
+    cout << "        Write the haartraining format from the names of images clipped in the directory" << endl;
+    cout << "        by -o or -i, which must have %i, %x, %y, %w and %h, and exit. Rotated or" << endl;
+    cout << "        sheared regions are skipped." << endl;
+    cout << "        Written to the --haartraining file or stdout." << endl;
+    cout << "    --journal <journal>" << endl;
+    cout << "        Append a binary record of every region saved to the journal. Paths are" << endl;
+    cout << "        numbered in journal.names." << endl;
+    cout << "    --dump-journal <journal>" << endl;
+    cout << "        Print the journal as text, one region per line, and exit:" << endl;
+    cout << "        \"time source frame x y width height rotation shear_x shear_y output\"" << endl;
+    cout << "    --session <session>" << endl;
+    cout << "        Save the image or frame shown and the rectangle to the session as you go," << endl;
+    cout << "        and resume from it when started again with the same reference." << endl;
+    cout << "    --shard-mb <shard_mb = 1024> (tar:)" << endl;
+    cout << "        Determine the size in MB at which a tar shard is rolled over to the next." << endl;
+    cout << "    --raw-size <raw_size = 64x64> (raw:)" << endl;
+    cout << "        Determine the width and height images are resized to for raw:." << endl;
     cout << "    -h" << endl;
     cout << "    --help" << endl;
     cout << "        Show this help" << endl;
@@ -875,5 +1358,7 @@ void gui_usage()
     cout << "    h (left) j (down) k (up) l (right) : Move rectangle. (vi-like keybinds)" << endl;
     cout << "    y (left) u (down) i (up) o (right) : Resize rectangle. (Move boundaries)" << endl;
     cout << "    n (left) m (down) , (up) . (right) : Shear deformation." << endl;
+    cout << "    z (zoom in) Z (zoom out): Zoom the main window." << endl;
+    cout << "    H (left) J (down) K (up) L (right) : Pan the main window." << endl;
 }
 
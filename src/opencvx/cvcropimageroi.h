@@ -30,15 +30,286 @@
 #define _USE_MATH_DEFINES
 #include <math.h>
 
+#include <string.h>
+#include <limits.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CV_CROP_SSE2 1
+#endif
+
 #include "cvcreateaffine.h"
 #include "cvrect32f.h"
 
+/* interpolation flag of cvCropImageROI to run the original per-pixel loop,
+   kept for bit-exact comparison */
+#define CV_CROP_REFERENCE 64
+
 CVAPI(void) cvCropImageROI( const IplImage* img, IplImage* dst, 
                             CvRect32f rect32f = cvRect32f(0,0,1,1,0),
-                            CvPoint2D32f shear = cvPoint2D32f(0,0) );
+                            CvPoint2D32f shear = cvPoint2D32f(0,0),
+                            int interpolation = CV_INTER_NN );
+CVAPI(void) cvCropImageROIScaled( const IplImage* img, IplImage* dst, 
+                            CvRect32f rect32f = cvRect32f(0,0,1,1,0),
+                            CvPoint2D32f shear = cvPoint2D32f(0,0),
+                            int interpolation = CV_INTER_NN );
 CVAPI(void) cvShowCroppedImage( const char* w_name, IplImage* orig, 
                             CvRect32f rect32f = cvRect32f(0,0,1,1,0),
-                            CvPoint2D32f shear = cvPoint2D32f(0,0) );
+                            CvPoint2D32f shear = cvPoint2D32f(0,0),
+                            int max_size = 0 );
+
+CV_INLINE void icvCopyPixel8u( uchar* d, const uchar* s, int cn )
+{
+    switch( cn )
+    {
+    case 1: d[0] = s[0]; break;
+    case 3: d[0] = s[0]; d[1] = s[1]; d[2] = s[2]; break;
+    case 4: memcpy( d, s, 4 ); break;
+    default: memcpy( d, s, cn ); break;
+    }
+}
+
+/**
+ * Nearest neighbor sampling of one row for 8-bit images
+ *
+ * dst(x,y) = img( cvRound(c[0]*x + c[1]*y + c[2]) + offset.x,
+ *                 cvRound(c[3]*x + c[4]*y + c[5]) + offset.y )
+ *
+ * x is stepped in vector registers; 4 pixels are mapped per iteration
+ * with SSE2 or AVX2 (4-channel images are gathered with AVX2 unless byte
+ * offsets in the image overflow the 32-bit gather indices).
+ * The result is bit-exact with the scalar expression above.
+ */
+CV_INLINE void icvCropAffineRowNN8u( const IplImage* img, uchar* drow, int width, int y,
+                                     const double* c, CvPoint offset )
+{
+    const uchar* src = (const uchar*)img->imageData;
+    int cn = img->nChannels, step = img->widthStep;
+    double ru = c[1] * y + c[2];
+    double rv = c[4] * y + c[5];
+    int x = 0;
+#if defined(CV_CROP_SSE2)
+    {
+        int iu[4], iv[4];
+        const __m128i ox = _mm_set1_epi32( offset.x ), oy = _mm_set1_epi32( offset.y );
+        const __m128i w = _mm_set1_epi32( img->width ), h = _mm_set1_epi32( img->height );
+        const __m128i minus1 = _mm_set1_epi32( -1 );
+#if defined(__AVX2__)
+        const __m256d a = _mm256_set1_pd( c[0] ), d = _mm256_set1_pd( c[3] );
+        const __m256d bu = _mm256_set1_pd( ru ), bv = _mm256_set1_pd( rv );
+        const __m256d four = _mm256_set1_pd( 4 );
+        const __m128i vstep = _mm_set1_epi32( step );
+        const bool gather = cn == 4 && (size_t)img->height * step <= (size_t)INT_MAX;
+        __m256d xs = _mm256_set_pd( 3, 2, 1, 0 );
+#else
+        const __m128d a = _mm_set1_pd( c[0] ), d = _mm_set1_pd( c[3] );
+        const __m128d bu = _mm_set1_pd( ru ), bv = _mm_set1_pd( rv );
+        const __m128d four = _mm_set1_pd( 4 );
+        __m128d xs0 = _mm_set_pd( 1, 0 ), xs1 = _mm_set_pd( 3, 2 );
+#endif
+        for( ; x <= width - 4; x += 4 )
+        {
+#if defined(__AVX2__)
+            __m128i u = _mm256_cvtpd_epi32( _mm256_add_pd( _mm256_mul_pd( a, xs ), bu ) );
+            __m128i v = _mm256_cvtpd_epi32( _mm256_add_pd( _mm256_mul_pd( d, xs ), bv ) );
+            xs = _mm256_add_pd( xs, four );
+#else
+            __m128i u = _mm_unpacklo_epi64(
+                _mm_cvtpd_epi32( _mm_add_pd( _mm_mul_pd( a, xs0 ), bu ) ),
+                _mm_cvtpd_epi32( _mm_add_pd( _mm_mul_pd( a, xs1 ), bu ) ) );
+            __m128i v = _mm_unpacklo_epi64(
+                _mm_cvtpd_epi32( _mm_add_pd( _mm_mul_pd( d, xs0 ), bv ) ),
+                _mm_cvtpd_epi32( _mm_add_pd( _mm_mul_pd( d, xs1 ), bv ) ) );
+            xs0 = _mm_add_pd( xs0, four );
+            xs1 = _mm_add_pd( xs1, four );
+#endif
+            u = _mm_add_epi32( u, ox );
+            v = _mm_add_epi32( v, oy );
+            __m128i inside = _mm_and_si128(
+                _mm_and_si128( _mm_cmpgt_epi32( u, minus1 ), _mm_cmplt_epi32( u, w ) ),
+                _mm_and_si128( _mm_cmpgt_epi32( v, minus1 ), _mm_cmplt_epi32( v, h ) ) );
+#if defined(__AVX2__)
+            if( gather )
+            {
+                __m128i offs = _mm_add_epi32( _mm_mullo_epi32( v, vstep ), _mm_slli_epi32( u, 2 ) );
+                __m128i px = _mm_mask_i32gather_epi32( _mm_setzero_si128(), (const int*)src, offs, inside, 1 );
+                _mm_storeu_si128( (__m128i*)( drow + x * 4 ), px );
+                continue;
+            }
+#endif
+            int mask = _mm_movemask_ps( _mm_castsi128_ps( inside ) );
+            _mm_storeu_si128( (__m128i*)iu, u );
+            _mm_storeu_si128( (__m128i*)iv, v );
+            for( int i = 0; i < 4; i++ )
+            {
+                uchar* d = drow + ( x + i ) * cn;
+                if( mask & ( 1 << i ) )
+                    icvCopyPixel8u( d, src + (size_t)step * iv[i] + iu[i] * cn, cn );
+                else
+                    memset( d, 0, cn );
+            }
+        }
+    }
+#endif
+    for( ; x < width; x++ )
+    {
+        int xp = cvRound( c[0] * x + ru ) + offset.x;
+        int yp = cvRound( c[3] * x + rv ) + offset.y;
+        uchar* d = drow + x * cn;
+        if( xp < 0 || xp >= img->width || yp < 0 || yp >= img->height )
+            memset( d, 0, cn );
+        else
+            icvCopyPixel8u( d, src + (size_t)step * yp + xp * cn, cn );
+    }
+}
+
+/**
+ * Bilinear sampling of one row for 8-bit images (see icvCropAffineRowNN8u)
+ *
+ * Weights are 11-bit fixed point. Pixels whose 2x2 neighborhood is not
+ * inside of the image fall back to the nearest neighbor.
+ */
+CV_INLINE void icvCropAffineRowLinear8u( const IplImage* img, uchar* drow, int width, int y,
+                                         const double* c, CvPoint offset )
+{
+    const uchar* src = (const uchar*)img->imageData;
+    int cn = img->nChannels, step = img->widthStep;
+    double ru = c[1] * y + c[2] + offset.x;
+    double rv = c[4] * y + c[5] + offset.y;
+    for( int x = 0; x < width; x++ )
+    {
+        double u = c[0] * x + ru;
+        double v = c[3] * x + rv;
+        int x0 = cvFloor( u ), y0 = cvFloor( v );
+        uchar* d = drow + x * cn;
+        if( x0 >= 0 && y0 >= 0 && x0 + 1 < img->width && y0 + 1 < img->height )
+        {
+            int wx = cvRound( ( u - x0 ) * 2048 ), wy = cvRound( ( v - y0 ) * 2048 );
+            int w00 = ( 2048 - wx ) * ( 2048 - wy ), w01 = wx * ( 2048 - wy );
+            int w10 = ( 2048 - wx ) * wy,            w11 = wx * wy;
+            const uchar* p0 = src + (size_t)step * y0 + x0 * cn;
+            const uchar* p1 = p0 + step;
+            for( int ch = 0; ch < cn; ch++ )
+            {
+                d[ch] = (uchar)( ( p0[ch] * w00 + p0[ch + cn] * w01 +
+                                   p1[ch] * w10 + p1[ch + cn] * w11 + ( 1 << 21 ) ) >> 22 );
+            }
+            continue;
+        }
+        int xp = cvRound( u ), yp = cvRound( v );
+        if( xp < 0 || xp >= img->width || yp < 0 || yp >= img->height )
+            memset( d, 0, cn );
+        else
+            icvCopyPixel8u( d, src + (size_t)step * yp + xp * cn, cn );
+    }
+}
+
+/**
+ * Nearest neighbor sampling of one row for any depth
+ */
+CV_INLINE void icvCropAffineRowNN( const IplImage* img, uchar* drow, int width, int y,
+                                   const double* c, CvPoint offset )
+{
+    const uchar* src = (const uchar*)img->imageData;
+    int psize = img->nChannels * ( ( img->depth & 255 ) >> 3 );
+    double ru = c[1] * y + c[2];
+    double rv = c[4] * y + c[5];
+    for( int x = 0; x < width; x++ )
+    {
+        int xp = cvRound( c[0] * x + ru ) + offset.x;
+        int yp = cvRound( c[3] * x + rv ) + offset.y;
+        uchar* d = drow + x * psize;
+        if( xp < 0 || xp >= img->width || yp < 0 || yp >= img->height )
+            memset( d, 0, psize );
+        else
+            memcpy( d, src + (size_t)img->widthStep * yp + xp * psize, psize );
+    }
+}
+
+/**
+ * Crop by an affine mapping from dst to img coordinates, row by row
+ *
+ * dst(x,y) = img( c[0]*x + c[1]*y + c[2] + offset.x, c[3]*x + c[4]*y + c[5] + offset.y )
+ * Pixels mapped outside of img are set to 0. The integer offset is added
+ * after rounding with CV_INTER_NN.
+ *
+ * @param img            The source image
+ * @param dst            The destination image
+ * @param c              The 2 x 3 affine coefficients (row major)
+ * @param offset         The integer translation
+ * @param interpolation  CV_INTER_NN or CV_INTER_LINEAR (8-bit images only,
+ *                       others fall back to CV_INTER_NN)
+ */
+CV_INLINE void icvCropAffine( const IplImage* img, IplImage* dst, const double* c,
+                              CvPoint offset, int interpolation )
+{
+    for( int y = 0; y < dst->height; y++ )
+    {
+        uchar* drow = (uchar*)dst->imageData + (size_t)dst->widthStep * y;
+        if( img->depth != IPL_DEPTH_8U )
+            icvCropAffineRowNN( img, drow, dst->width, y, c, offset );
+        else if( interpolation == CV_INTER_LINEAR )
+            icvCropAffineRowLinear8u( img, drow, dst->width, y, c, offset );
+        else
+            icvCropAffineRowNN8u( img, drow, dst->width, y, c, offset );
+    }
+}
+
+/**
+ * Affine coefficients of icvCropAffine for a rotated and sheared rectangle
+ *
+ * @param rect32f  The rectangle region and the rotation angle
+ * @param shear    The shear deformation parameter shx and shy
+ * @param c        The 2 x 3 affine coefficients (row major) to be set
+ * @return The integer translation for icvCropAffine
+ */
+CV_INLINE CvPoint icvCropCoeffs( CvRect32f rect32f, CvPoint2D32f shear, double* c )
+{
+    if( shear.x == 0 && shear.y == 0 )
+    {
+        CvRect rect = cvRectFromRect32f( rect32f );
+        double cs = cos( -M_PI / 180 * rect32f.angle );
+        double sn = sin( -M_PI / 180 * rect32f.angle );
+        c[0] = cs; c[1] = -sn; c[2] = 0;
+        c[3] = sn; c[4] =  cs; c[5] = 0;
+        return cvPoint( rect.x, rect.y );
+    }
+    // fold the affine for normalized coordinates (x/width, y/height) 
+    // into coefficients for pixel coordinates
+    CvMat* affine = cvCreateMat( 2, 3, CV_64FC1 );
+    cvCreateAffine( affine, rect32f, shear );
+    c[0] = cvmGet( affine, 0, 0 ) / rect32f.width;
+    c[1] = cvmGet( affine, 0, 1 ) / rect32f.height;
+    c[2] = cvmGet( affine, 0, 2 );
+    c[3] = cvmGet( affine, 1, 0 ) / rect32f.width;
+    c[4] = cvmGet( affine, 1, 1 ) / rect32f.height;
+    c[5] = cvmGet( affine, 1, 2 );
+    cvReleaseMat( &affine );
+    return cvPoint( 0, 0 );
+}
+
+/**
+ * 4 corners of a rotated and sheared rectangle in the same mapping as
+ * cvCropImageROI and cvDrawRectangle use
+ *
+ * @param rect32f  The rectangle region and the rotation angle
+ * @param shear    The shear deformation parameter shx and shy
+ * @param pt       The corners (0,0), (width,0), (width,height), (0,height) mapped
+ */
+CV_INLINE void icvCropCorners( CvRect32f rect32f, CvPoint2D32f shear, CvPoint2D32f pt[4] )
+{
+    double c[6];
+    CvPoint offset = icvCropCoeffs( rect32f, shear, c );
+    double xs[] = { 0, rect32f.width, rect32f.width, 0 };
+    double ys[] = { 0, 0, rect32f.height, rect32f.height };
+    for( int i = 0; i < 4; i++ )
+    {
+        pt[i].x = (float)( c[0] * xs[i] + c[1] * ys[i] + c[2] + offset.x );
+        pt[i].y = (float)( c[3] * xs[i] + c[4] * ys[i] + c[5] + offset.y );
+    }
+}
 
 /**
  * Crop image with rotated and sheared rectangle
@@ -54,9 +325,13 @@ CVAPI(void) cvShowCroppedImage( const char* w_name, IplImage* orig,
  *                     the rotation angle in degree where the rotation center is (x,y)
  * @param [shear = cvPoint2D32f(0,0)]
  *                     The shear deformation parameter shx and shy
+ * @param [interpolation = CV_INTER_NN]
+ *                     CV_INTER_NN, CV_INTER_LINEAR, or CV_CROP_REFERENCE to
+ *                     run the original per-pixel loop for comparison
  * @return void
  */
-CVAPI(void) cvCropImageROI( const IplImage* img, IplImage* dst, CvRect32f rect32f, CvPoint2D32f shear )
+CVAPI(void) cvCropImageROI( const IplImage* img, IplImage* dst, CvRect32f rect32f, CvPoint2D32f shear,
+                            int interpolation )
 {
     CvRect rect = cvRectFromRect32f( rect32f );
     float angle = rect32f.angle;
@@ -74,6 +349,12 @@ CVAPI(void) cvCropImageROI( const IplImage* img, IplImage* dst, CvRect32f rect32
         cvGetSubRect( img, &subimg, rect );
         cvConvert( &subimg, dst );
     }
+    else if( interpolation != CV_CROP_REFERENCE )
+    {
+        double coeffs[6];
+        CvPoint offset = icvCropCoeffs( rect32f, shear, coeffs );
+        icvCropAffine( img, dst, coeffs, offset, interpolation );
+    }
     else if( shear.x == 0 && shear.y == 0 )
     {
         int x, y, ch, xp, yp;
@@ -95,8 +376,8 @@ CVAPI(void) cvCropImageROI( const IplImage* img, IplImage* dst, CvRect32f rect32
                 if( xp < 0 || xp >= img->width || yp < 0 || yp >= img->height ) continue;
                 for( ch = 0; ch < img->nChannels; ch++ )
                 {
-                    dst->imageData[dst->widthStep * y + x * dst->nChannels + ch]
-                        = img->imageData[img->widthStep * yp + xp * img->nChannels + ch];
+                    dst->imageData[(size_t)dst->widthStep * y + x * dst->nChannels + ch]
+                        = img->imageData[(size_t)img->widthStep * yp + xp * img->nChannels + ch];
                 }
             }
         }
@@ -123,8 +404,8 @@ CVAPI(void) cvCropImageROI( const IplImage* img, IplImage* dst, CvRect32f rect32
                 if( xp < 0 || xp >= img->width || yp < 0 || yp >= img->height ) continue;
                 for( ch = 0; ch < img->nChannels; ch++ )
                 {
-                    dst->imageData[dst->widthStep * y + x * dst->nChannels + ch]
-                        = img->imageData[img->widthStep * yp + xp * img->nChannels + ch];
+                    dst->imageData[(size_t)dst->widthStep * y + x * dst->nChannels + ch]
+                        = img->imageData[(size_t)img->widthStep * yp + xp * img->nChannels + ch];
                 }
             }
         }
@@ -135,6 +416,42 @@ CVAPI(void) cvCropImageROI( const IplImage* img, IplImage* dst, CvRect32f rect32
     __END__;
 }
 
+/**
+ * Crop image with rotated and sheared rectangle and resize it to dst
+ *
+ * Pixels are sampled through the affine mapping at the resolution of dst,
+ * so the cost depends on the size of dst, not on the size of rectangle.
+ *
+ * @param img          The target image
+ * @param dst          The resized cropped image of any size
+ * @param [rect32f = cvRect32f(0,0,1,1,0)]
+ *                     The rectangle region (x,y,width,height) to crop and 
+ *                     the rotation angle in degree where the rotation center is (x,y)
+ * @param [shear = cvPoint2D32f(0,0)]
+ *                     The shear deformation parameter shx and shy
+ * @param [interpolation = CV_INTER_NN]
+ *                     CV_INTER_NN or CV_INTER_LINEAR
+ * @return void
+ */
+CVAPI(void) cvCropImageROIScaled( const IplImage* img, IplImage* dst, CvRect32f rect32f, CvPoint2D32f shear,
+                                  int interpolation )
+{
+    CvRect rect = cvRectFromRect32f( rect32f );
+    double coeffs[6], sx, sy;
+    CvPoint offset;
+    CV_FUNCNAME( "cvCropImageROIScaled" );
+    __BEGIN__;
+    CV_ASSERT( rect.width > 0 && rect.height > 0 );
+    CV_ASSERT( dst->width > 0 && dst->height > 0 );
+    offset = icvCropCoeffs( rect32f, shear, coeffs );
+    sx = (double)rect.width / dst->width;
+    sy = (double)rect.height / dst->height;
+    coeffs[0] *= sx; coeffs[3] *= sx;
+    coeffs[1] *= sy; coeffs[4] *= sy;
+    icvCropAffine( img, dst, coeffs, offset, interpolation );
+    __END__;
+}
+
 /**
  * Crop and show the Cropped Image
  *
@@ -145,13 +462,29 @@ CVAPI(void) cvCropImageROI( const IplImage* img, IplImage* dst, CvRect32f rect32
  *                     the rotation angle in degree
  * @param [shear = cvPoint2D32f(0,0)]
  *                     The shear deformation parameter shx and shy
+ * @param [max_size = 0]
+ *                     The maximum width and height to be shown. A larger
+ *                     rectangle is shown shrunk keeping its aspect ratio,
+ *                     and is sampled at the shown size. 0 for no limit.
  * @return void
- * @uses cvCropImageROI
+ * @uses cvCropImageROI, cvCropImageROIScaled
  */
-CVAPI(void) cvShowCroppedImage( const char* w_name, IplImage* img, CvRect32f rect32f, CvPoint2D32f shear )
+CVAPI(void) cvShowCroppedImage( const char* w_name, IplImage* img, CvRect32f rect32f, CvPoint2D32f shear,
+                                int max_size )
 {
     CvRect rect = cvRectFromRect32f( rect32f );
     if( rect.width <= 0 || rect.height <= 0 ) return;
+    if( max_size > 0 && ( rect.width > max_size || rect.height > max_size ) )
+    {
+        double scale = (double)max_size / MAX( rect.width, rect.height );
+        CvSize size = cvSize( MAX( 1, cvRound( rect.width * scale ) ),
+                              MAX( 1, cvRound( rect.height * scale ) ) );
+        IplImage* preview = cvCreateImage( size, img->depth, img->nChannels );
+        cvCropImageROIScaled( img, preview, rect32f, shear );
+        cvShowImage( w_name, preview );
+        cvReleaseImage( &preview );
+        return;
+    }
     IplImage* crop = cvCreateImage( cvSize( rect.width, rect.height ), img->depth, img->nChannels );
     cvCropImageROI( img, crop, rect32f, shear );
     cvShowImage( w_name, crop );